@@ -2,95 +2,456 @@
 #define MEREMEMO_LOG_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <climits>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <filesystem>
-#include <fstream>
+#include <initializer_list>
 #include <iomanip>
+#include <istream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
-#include <sstream>
+#include <span>
+#include <stdexcept>
+#include <streambuf>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Log levels ranked below this are removed at compile time
+// when logging with MEREMEMO_LOG.
+#ifndef MEREMEMO_MIN_LEVEL
+#define MEREMEMO_MIN_LEVEL 0
+#endif
+
 namespace MereMemo
 {
 
-inline std::mutex & getLoggingMutex ()
+struct TagKeyTable
 {
-    static std::mutex m;
-    return m;
+    std::mutex mutex;
+    std::map<std::string, int, std::less<>> ids;
+    std::deque<std::string> names;
+};
+
+inline TagKeyTable & getTagKeyTable ()
+{
+    static TagKeyTable table;
+    return table;
+}
+
+// Each tag key is given a small integer id the first time it is
+// seen so that tags can be compared and looked up by id. The ids
+// start at zero and have no gaps.
+inline int internTagKey (std::string_view key)
+{
+    auto & table = getTagKeyTable();
+    const std::lock_guard<std::mutex> lock(table.mutex);
+    auto iter = table.ids.find(key);
+    if (iter != table.ids.end())
+    {
+        return iter->second;
+    }
+    int id = static_cast<int>(table.names.size());
+    table.names.emplace_back(key);
+    table.ids.emplace(key, id);
+    return id;
+}
+
+inline std::string_view tagKeyName (int keyId)
+{
+    auto & table = getTagKeyTable();
+    const std::lock_guard<std::mutex> lock(table.mutex);
+    if (keyId < 0 || keyId >= static_cast<int>(table.names.size()))
+    {
+        return {};
+    }
+    return table.names[keyId];
+}
+
+// Values in the binary log format are written in little-endian
+// order no matter what the host uses.
+enum class BinaryType : std::uint8_t
+{
+    String = 1,
+    Int,
+    LongLong,
+    Double,
+    Bool
+};
+
+template <typename T>
+void appendBinary (std::string & buffer, T value)
+{
+    static_assert(std::is_integral_v<T>);
+    using UnsignedT = std::make_unsigned_t<T>;
+    UnsignedT bits = static_cast<UnsignedT>(value);
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+    {
+        buffer += static_cast<char>(bits & 0xff);
+        bits = static_cast<UnsignedT>(bits >> 8);
+    }
+}
+
+inline void appendBinary (std::string & buffer, double value)
+{
+    appendBinary(buffer, std::bit_cast<std::uint64_t>(value));
+}
+
+inline void appendBinary (std::string & buffer, std::string_view value)
+{
+    appendBinary(buffer, static_cast<std::uint32_t>(value.size()));
+    buffer += value;
+}
+
+enum class TagOperation
+{
+    None,
+    Equal,
+    LessThan,
+    LessThanOrEqual,
+    GreaterThan,
+    GreaterThanOrEqual
+};
+
+// The value of any tag type. String values are views of the
+// text held by the tag.
+using TagValue = std::variant<int, long long, double, bool, std::string_view>;
+
+// Whole and decimal numbers can be compared with each other. A
+// decimal on either side turns both into decimals so that a filter
+// for 2 matches a value of 2.0 and a filter for 1 is less than 1.5.
+// Whole numbers of different types are both read as long long.
+inline bool promoteTagValues (TagValue & value, TagValue & criteria)
+{
+    auto const isNumber = [] (TagValue const & typed)
+    {
+        return std::holds_alternative<int>(typed) ||
+            std::holds_alternative<long long>(typed) ||
+            std::holds_alternative<double>(typed);
+    };
+    if (not isNumber(value) || not isNumber(criteria))
+    {
+        return false;
+    }
+    bool const decimal = std::holds_alternative<double>(value) ||
+        std::holds_alternative<double>(criteria);
+    auto const promote = [decimal] (TagValue & typed)
+    {
+        typed = std::visit([decimal] (auto number) -> TagValue
+        {
+            using NumberT = decltype(number);
+            if constexpr (std::is_arithmetic_v<NumberT>)
+            {
+                if (decimal)
+                {
+                    return static_cast<double>(number);
+                }
+                return static_cast<long long>(number);
+            }
+            else
+            {
+                return number;
+            }
+        }, typed);
+    };
+    promote(value);
+    promote(criteria);
+    return true;
+}
+
+inline bool compareTagValues (TagValue const & value,
+    TagOperation operation,
+    TagValue const & criteria)
+{
+    if (value.index() != criteria.index())
+    {
+        TagValue promotedValue = value;
+        TagValue promotedCriteria = criteria;
+        if (not promoteTagValues(promotedValue, promotedCriteria))
+        {
+            return false;
+        }
+        return compareTagValues(promotedValue, operation, promotedCriteria);
+    }
+    return std::visit([&criteria, operation] (auto const & lhs)
+    {
+        using ValueT = std::decay_t<decltype(lhs)>;
+        auto const & rhs = std::get<ValueT>(criteria);
+        if constexpr (std::is_same_v<ValueT, bool>)
+        {
+            return operation == TagOperation::Equal && lhs == rhs;
+        }
+        else
+        {
+            switch (operation)
+            {
+            case TagOperation::Equal:
+                return lhs == rhs;
+
+            case TagOperation::LessThan:
+                return lhs < rhs;
+
+            case TagOperation::LessThanOrEqual:
+                return lhs <= rhs;
+
+            case TagOperation::GreaterThan:
+                return lhs > rhs;
+
+            case TagOperation::GreaterThanOrEqual:
+                return lhs >= rhs;
+
+            default:
+                return false;
+            }
+        }
+    }, value);
+}
+
+// This follows the same rules as TagType::match.
+inline bool matchTagValues (TagOperation operation,
+    TagValue const & value,
+    TagOperation otherOperation,
+    TagValue const & otherValue)
+{
+    if (operation == TagOperation::None)
+    {
+        if (otherOperation == TagOperation::None)
+        {
+            return compareTagValues(value, TagOperation::Equal, otherValue);
+        }
+        return compareTagValues(value, otherOperation, otherValue);
+    }
+    if (otherOperation == TagOperation::None)
+    {
+        return compareTagValues(otherValue, operation, value);
+    }
+    return false;
 }
 
+// A tag held as plain values so that it can be copied into a
+// record or a configuration without any memory allocation. The
+// text and any string value are views of the text held by a Tag
+// which needs to outlive the data.
+struct TagData
+{
+    int keyId {-1};
+    TagOperation operation {TagOperation::None};
+    TagValue value;
+    std::string_view text;
+    std::string_view key;
+
+    bool matches (TagData const & other) const
+    {
+        return keyId == other.keyId &&
+            matchTagValues(operation, value, other.operation, other.value);
+    }
+
+    // Writes the key id and the typed value in the binary log format.
+    void encode (std::string & buffer) const
+    {
+        appendBinary(buffer, static_cast<std::uint32_t>(keyId));
+        std::visit([&buffer] (auto const & typed)
+        {
+            using ValueT = std::decay_t<decltype(typed)>;
+            if constexpr (std::is_same_v<ValueT, std::string_view>)
+            {
+                appendBinary(buffer, static_cast<std::uint8_t>(BinaryType::String));
+                appendBinary(buffer, typed);
+            }
+            else if constexpr (std::is_same_v<ValueT, int>)
+            {
+                appendBinary(buffer, static_cast<std::uint8_t>(BinaryType::Int));
+                appendBinary(buffer, static_cast<std::int32_t>(typed));
+            }
+            else if constexpr (std::is_same_v<ValueT, long long>)
+            {
+                appendBinary(buffer, static_cast<std::uint8_t>(BinaryType::LongLong));
+                appendBinary(buffer, static_cast<std::int64_t>(typed));
+            }
+            else if constexpr (std::is_same_v<ValueT, double>)
+            {
+                appendBinary(buffer, static_cast<std::uint8_t>(BinaryType::Double));
+                appendBinary(buffer, typed);
+            }
+            else
+            {
+                static_assert(std::is_same_v<ValueT, bool>);
+                appendBinary(buffer, static_cast<std::uint8_t>(BinaryType::Bool));
+                appendBinary(buffer, static_cast<std::uint8_t>(typed));
+            }
+        }, value);
+    }
+};
+
 class Tag
 {
 public:
     virtual ~Tag () = default;
 
-    std::string key () const
+    std::string_view key () const
     {
         return mKey;
     }
 
-    std::string text () const
+    int keyId () const
+    {
+        return mKeyId;
+    }
+
+    std::string_view text () const
     {
         return mText;
     }
 
+    TagOperation operation () const
+    {
+        return mOperation;
+    }
+
+    TagValue typedValue () const
+    {
+        switch (mNumericValue.index())
+        {
+        case 1:
+            return std::get<int>(mNumericValue);
+
+        case 2:
+            return std::get<long long>(mNumericValue);
+
+        case 3:
+            return std::get<double>(mNumericValue);
+
+        case 4:
+            return std::get<bool>(mNumericValue);
+
+        default:
+            // The string value sits between the quotes in the text.
+            return std::string_view(mText).substr(
+                mKey.size() + 2, mText.size() - mKey.size() - 3);
+        }
+    }
+
+    // The data refers to the text held by this tag.
+    TagData const & data () const
+    {
+        return mData;
+    }
+
     virtual std::unique_ptr<Tag> clone () const = 0;
 
     virtual bool match (Tag const & other) const = 0;
 
+    // Writes the key id and the typed value in the binary log format.
+    void encode (std::string & buffer) const
+    {
+        data().encode(buffer);
+    }
+
 protected:
-    Tag (std::string const & key, std::string const & value)
-    : mKey(key), mText(key + "=\"" + value + "\"")
+    // The key must refer to storage that lives as long as the
+    // program such as the static key of each tag type.
+    Tag (std::string_view key, int keyId, std::string const & value,
+        TagOperation operation)
+    : mKey(key), mKeyId(keyId), mOperation(operation),
+    mText(std::string(key) + "=\"" + value + "\""),
+    mData(makeData())
+    { }
+
+    Tag (std::string_view key, int keyId, int value,
+        TagOperation operation)
+    : mKey(key), mKeyId(keyId), mOperation(operation),
+    mNumericValue(value),
+    mText(std::string(key) + "=" + std::to_string(value)),
+    mData(makeData())
     { }
 
-    Tag (std::string const & key, int value)
-    : mKey(key), mText(key + "=" + std::to_string(value))
+    Tag (std::string_view key, int keyId, long long value,
+        TagOperation operation)
+    : mKey(key), mKeyId(keyId), mOperation(operation),
+    mNumericValue(value),
+    mText(std::string(key) + "=" + std::to_string(value)),
+    mData(makeData())
     { }
 
-    Tag (std::string const & key, long long value)
-    : mKey(key), mText(key + "=" + std::to_string(value))
+    Tag (std::string_view key, int keyId, double value,
+        TagOperation operation)
+    : mKey(key), mKeyId(keyId), mOperation(operation),
+    mNumericValue(value),
+    mText(std::string(key) + "=" + std::to_string(value)),
+    mData(makeData())
     { }
 
-    Tag (std::string const & key, double value)
-    : mKey(key), mText(key + "=" + std::to_string(value))
+    Tag (std::string_view key, int keyId, bool value,
+        TagOperation operation)
+    : mKey(key), mKeyId(keyId), mOperation(operation),
+    mNumericValue(value),
+    mText(std::string(key) + "=" + (value?"true":"false")),
+    mData(makeData())
     { }
 
-    Tag (std::string const & key, bool value)
-    : mKey(key), mText(key + "=" + (value?"true":"false"))
+    // A copy needs its own data that refers to its own text.
+    Tag (Tag const & other)
+    : mKey(other.mKey), mKeyId(other.mKeyId), mOperation(other.mOperation),
+    mNumericValue(other.mNumericValue),
+    mText(other.mText),
+    mData(makeData())
     { }
 
 private:
-    std::string mKey;
+    TagData makeData () const
+    {
+        return {mKeyId, mOperation, typedValue(), mText, mKey};
+    }
+
+    std::string_view mKey;
+    int mKeyId;
+    TagOperation mOperation;
+    std::variant<std::monostate, int, long long, double, bool> mNumericValue;
     std::string const mText;
+    TagData mData;
 };
 
 inline std::string to_string (Tag const & tag)
 {
-    return tag.text();
+    return std::string(tag.text());
 }
 
-inline std::ostream & operator << (std::ostream && stream, Tag const & tag)
+inline std::ostream & operator << (std::ostream & stream, Tag const & tag)
 {
-    stream << to_string(tag);
+    stream << tag.text();
     return stream;
 }
 
-enum class TagOperation
-{
-    None,
-    Equal,
-    LessThan,
-    LessThanOrEqual,
-    GreaterThan,
-    GreaterThanOrEqual
-};
-
 template <typename T, typename ValueT>
 class TagType : public Tag
 {
@@ -103,29 +464,29 @@ public:
 
     bool match (Tag const & other) const override
     {
-        if (key() != other.key())
+        if (keyId() != other.keyId())
         {
             return false;
         }
         TagType const & otherCast = static_cast<TagType const &>(other);
-        if (mOperation == TagOperation::None)
+        if (operation() == TagOperation::None)
         {
-            switch (otherCast.mOperation)
+            switch (otherCast.operation())
             {
             case TagOperation::None:
                 return mValue == otherCast.mValue;
 
             default:
                 return compareTagTypes(mValue,
-                    otherCast.mOperation,
+                    otherCast.operation(),
                     otherCast.mValue);
             }
         }
-        switch (otherCast.mOperation)
+        switch (otherCast.operation())
         {
         case TagOperation::None:
             return compareTagTypes(otherCast.mValue,
-                mOperation,
+                operation(),
                 mValue);
 
         default:
@@ -141,9 +502,16 @@ public:
 protected:
     TagType (ValueT const & value,
         TagOperation operation)
-    : Tag(T::key, value), mValue(value), mOperation(operation)
+    : Tag(T::key, typeKeyId(), value, operation),
+    mValue(value)
     { }
 
+    static int typeKeyId ()
+    {
+        static int const id = internTagKey(T::key);
+        return id;
+    }
+
     virtual bool compareTagTypes (ValueT const & value,
         TagOperation operation,
         ValueT const & criteria) const
@@ -152,7 +520,6 @@ protected:
     }
 
     ValueT mValue;
-    TagOperation mOperation;
 };
 
 template <typename T>
@@ -175,16 +542,16 @@ protected:
             return result == 0;
 
         case TagOperation::LessThan:
-            return result == -1;
+            return result < 0;
 
         case TagOperation::LessThanOrEqual:
-            return result == 0 || result == -1;
+            return result <= 0;
 
         case TagOperation::GreaterThan:
-            return result == 1;
+            return result > 0;
 
         case TagOperation::GreaterThanOrEqual:
-            return result == 0 || result == 1;
+            return result >= 0;
 
         default:
             return false;
@@ -335,293 +702,4540 @@ public:
     { }
 };
 
-inline std::map<std::string, std::unique_ptr<Tag>> & getDefaultTags ()
-{
-    static std::map<std::string, std::unique_ptr<Tag>> tags;
-    return tags;
-}
-
-inline void addDefaultTag (Tag const & tag)
+template <int Rank>
+class RankedLogLevel : public LogLevel
 {
-    auto & tags = getDefaultTags();
-    tags[tag.key()] = tag.clone();
-}
+public:
+    static constexpr int rank = Rank;
 
-struct FilterClause
-{
-    std::vector<std::unique_ptr<Tag>> normalLiterals;
-    std::vector<std::unique_ptr<Tag>> invertedLiterals;
+    RankedLogLevel (std::string const & value,
+        TagOperation operation = TagOperation::None)
+    : LogLevel(value, operation)
+    { }
 };
 
-inline std::map<int, FilterClause> & getFilterClauses ()
+template <typename T>
+constexpr bool isLogLevelEnabled ()
 {
-    static std::map<int, FilterClause> clauses;
-    return clauses;
+    if constexpr (requires { T::rank; })
+    {
+        return T::rank >= MEREMEMO_MIN_LEVEL;
+    }
+    else
+    {
+        // A log level without a rank can only be
+        // filtered at run time.
+        return true;
+    }
 }
 
-inline int createFilterClause ()
+// The default tags of a configuration sorted by key id together
+// with their text and binary encodings in key name order. These are
+// only built when the default tags change so that a record can copy
+// each run of defaults that sits between its other tags at once.
+struct DefaultTags
 {
-    static int currentId = 0;
-    ++currentId;
-    auto & clauses = getFilterClauses();
-    clauses[currentId] = FilterClause();
+    // Where a tag starts in the text and binary encodings.
+    struct Rendered
+    {
+        std::size_t tag;
+        std::size_t textOffset;
+        std::size_t binaryOffset;
+    };
 
-    return currentId;
-}
+    std::vector<TagData> tags;
+    // The tags in key name order followed by one more entry that
+    // holds the sizes of the encodings.
+    std::vector<Rendered> ordered;
+    std::string text;
+    std::string binary;
+    int maxKeyId {-1};
 
-inline void addFilterLiteral (int filterId,
-    Tag const & tag,
-    bool normal = true)
-{
-    auto & clauses = getFilterClauses();
-    if (clauses.contains(filterId))
+    void build (std::map<int, std::shared_ptr<Tag const>> const & defaults)
     {
-        if (normal)
+        tags.clear();
+        ordered.clear();
+        text.clear();
+        binary.clear();
+        maxKeyId = -1;
+        for (auto const & [keyId, tag]: defaults)
         {
-            clauses[filterId].normalLiterals.push_back(
-                tag.clone());
+            ordered.push_back({tags.size(), 0, 0});
+            tags.push_back(tag->data());
+            maxKeyId = std::max(maxKeyId, keyId);
         }
-        else
+        std::sort(ordered.begin(), ordered.end(),
+            [this] (Rendered const & lhs, Rendered const & rhs)
         {
-            clauses[filterId].invertedLiterals.push_back(
-                tag.clone());
+            return tags[lhs.tag].key < tags[rhs.tag].key;
+        });
+        for (auto & rendered: ordered)
+        {
+            rendered.textOffset = text.size();
+            rendered.binaryOffset = binary.size();
+            text += ' ';
+            text += tags[rendered.tag].text;
+            tags[rendered.tag].encode(binary);
         }
+        ordered.push_back({tags.size(), text.size(), binary.size()});
     }
-}
-
-inline void clearFilterClause (int filterId)
-{
-    auto & clauses = getFilterClauses();
-    clauses.erase(filterId);
-}
-
-class Output
-{
-public:
-    virtual ~Output () = default;
-    Output (Output const & other) = delete;
-    Output (Output && other) = delete;
 
-    virtual std::unique_ptr<Output> clone () const = 0;
+    // The tag at index in key name order.
+    TagData const & orderedTag (std::size_t index) const
+    {
+        return tags[ordered[index].tag];
+    }
 
-    virtual void sendLine (std::string const & line) = 0;
+    std::string_view textRun (std::size_t begin, std::size_t end) const
+    {
+        return std::string_view(text).substr(ordered[begin].textOffset,
+            ordered[end].textOffset - ordered[begin].textOffset);
+    }
 
-    Output & operator = (Output const & rhs) = delete;
-    Output & operator = (Output && rhs) = delete;
+    std::string_view binaryRun (std::size_t begin, std::size_t end) const
+    {
+        return std::string_view(binary).substr(ordered[begin].binaryOffset,
+            ordered[end].binaryOffset - ordered[begin].binaryOffset);
+    }
 
-protected:
-    Output () = default;
+    TagData const * find (int keyId) const
+    {
+        auto pos = std::lower_bound(tags.begin(), tags.end(), keyId,
+            [] (TagData const & lhs, int keyId)
+        {
+            return lhs.keyId < keyId;
+        });
+        if (pos != tags.end() && pos->keyId == keyId)
+        {
+            return &*pos;
+        }
+        return nullptr;
+    }
 };
 
-inline std::vector<std::unique_ptr<Output>> & getOutputs ()
-{
-    static std::vector<std::unique_ptr<Output>> outputs;
-    return outputs;
-}
-
-inline void addLogOutput (Output const & output)
-{
-    auto & outputs = getOutputs();
-    outputs.push_back(output.clone());
-}
-
-class FileOutput : public Output
+// Holds the tags for a single record. The default tags stay in the
+// configuration and only the other tags are kept here sorted by key
+// id. These are kept inline until there are more than will fit so
+// that a typical record needs no memory allocation.
+class ActiveTags
 {
 public:
-    FileOutput (std::string_view dir)
-    : mOutputDir(dir),
-    mFileNamePattern("{}"),
-    mMaxSize(0),
-    mRolloverCount(0)
-    { }
+    static constexpr std::size_t inlineCapacity = 16;
 
-    FileOutput (FileOutput const & rhs)
-    : mOutputDir(rhs.mOutputDir),
-    mFileNamePattern(rhs.mFileNamePattern),
-    mMaxSize(rhs.mMaxSize),
-    mRolloverCount(rhs.mRolloverCount)
+    ActiveTags ()
+    : mDefaults(nullptr), mReplacedDefaults(0), mSize(0)
     { }
 
-    FileOutput (FileOutput && rhs)
-    : mOutputDir(rhs.mOutputDir),
-    mFileNamePattern(rhs.mFileNamePattern),
-    mMaxSize(rhs.mMaxSize),
-    mRolloverCount(rhs.mRolloverCount),
-    mFile(std::move(rhs.mFile))
-    { }
+    ActiveTags (ActiveTags const & other) = delete;
 
-    ~FileOutput ()
+    ActiveTags (ActiveTags && other)
+    : mDefaults(other.mDefaults),
+    mReplacedDefaults(other.mReplacedDefaults),
+    mOverflow(std::move(other.mOverflow)),
+    mSize(other.mSize)
     {
-        mFile.close();
+        if (mOverflow.empty())
+        {
+            std::copy_n(other.mInline.tags, mSize, mInline.tags);
+        }
     }
 
-    std::unique_ptr<Output> clone () const override
+    ActiveTags & operator = (ActiveTags const & rhs) = delete;
+    ActiveTags & operator = (ActiveTags && rhs) = delete;
+
+    // Removes every tag but keeps the memory for the next record.
+    void clear ()
     {
-        return std::unique_ptr<Output>(
-            new FileOutput(*this));
+        mDefaults = nullptr;
+        mReplacedDefaults = 0;
+        mOverflow.clear();
+        mSize = 0;
     }
 
-    void sendLine (std::string const & line) override
+    void copyFrom (ActiveTags const & other)
     {
-        if (not mFile.is_open())
+        mDefaults = other.mDefaults;
+        mReplacedDefaults = other.mReplacedDefaults;
+        mSize = other.mSize;
+        if (other.mOverflow.empty())
+        {
+            mOverflow.clear();
+            std::copy_n(other.mInline.tags, mSize, mInline.tags);
+        }
+        else
         {
-            mFile.open("application.log", std::ios::app);
+            mOverflow = other.mOverflow;
         }
-        mFile << line << std::endl;
-        mFile.flush();
     }
 
-protected:
-    std::filesystem::path mOutputDir;
-    std::string mFileNamePattern;
-    std::size_t mMaxSize;
-    unsigned int mRolloverCount;
-    std::fstream mFile;
-};
-
-class StreamOutput : public Output
-{
-public:
-    StreamOutput (std::ostream & stream)
-    : mStream(stream)
-    { }
+    // The defaults need to be set before any other tags.
+    void setDefaults (DefaultTags const * defaults)
+    {
+        mDefaults = defaults;
+    }
 
-    StreamOutput (StreamOutput const & rhs)
-    : mStream(rhs.mStream)
+    // A tag replaces any tag already present with the same key.
+    void set (TagData const & tag)
+    {
+        TagData * first = storage();
+        TagData * last = first + mSize;
+        TagData * pos = std::lower_bound(first, last, tag.keyId,
+            [] (TagData const & lhs, int keyId)
+        {
+            return lhs.keyId < keyId;
+        });
+        if (pos != last && pos->keyId == tag.keyId)
+        {
+            *pos = tag;
+            return;
+        }
+        if (mDefaults && mDefaults->find(tag.keyId))
+        {
+            ++mReplacedDefaults;
+        }
+
+        std::size_t index = pos - first;
+        if (mOverflow.empty() && mSize < inlineCapacity)
+        {
+            std::move_backward(pos, last, last + 1);
+            mInline.tags[index] = tag;
+        }
+        else
+        {
+            if (mOverflow.empty())
+            {
+                mOverflow.assign(first, last);
+            }
+            mOverflow.insert(mOverflow.begin() + index, tag);
+        }
+        ++mSize;
+    }
+
+    TagData const * find (int keyId) const
+    {
+        TagData const * first = storage();
+        TagData const * last = first + mSize;
+        TagData const * pos = std::lower_bound(first, last, keyId,
+            [] (TagData const & lhs, int keyId)
+        {
+            return lhs.keyId < keyId;
+        });
+        if (pos != last && pos->keyId == keyId)
+        {
+            return pos;
+        }
+        return mDefaults ? mDefaults->find(keyId) : nullptr;
+    }
+
+    std::size_t size () const
+    {
+        std::size_t defaults = mDefaults ? mDefaults->tags.size() : 0;
+        return defaults - mReplacedDefaults + mSize;
+    }
+
+    // Copies the text of the tags set on this record into text and
+    // points the tags at the copy. The record can then outlive the
+    // tags it was given such as when its stream is kept in a named
+    // variable. The defaults belong to the configuration which the
+    // record keeps alive so they are left alone.
+    void copyTextInto (std::string & text)
+    {
+        TagData * first = storage();
+        TagData * last = first + mSize;
+        std::size_t total = 0;
+        for (TagData const * tag = first; tag != last; ++tag)
+        {
+            total += tag->text.size();
+        }
+        text.clear();
+        text.reserve(total);
+        for (TagData * tag = first; tag != last; ++tag)
+        {
+            std::string_view const copy(text.data() + text.size(),
+                tag->text.size());
+            text += tag->text;
+            // A string value is always a part of the text of its tag.
+            if (auto * value = std::get_if<std::string_view>(&tag->value))
+            {
+                *value = copy.substr(value->data() - tag->text.data(),
+                    value->size());
+            }
+            tag->text = copy;
+        }
+    }
+
+    // Visits the tags in key name order. The key ids depend on the
+    // order that a program first uses each key so they cannot be
+    // used to keep the lines looking the same from run to run. The
+    // defaults are already in name order so only the other tags get
+    // sorted and merged in. Each run of defaults between them goes
+    // to run as a range of DefaultTags::ordered and the other tags
+    // go to visit. A default with the key of another tag is skipped.
+    template <typename RunT, typename VisitT>
+    void forEachRun (RunT run, VisitT visit) const
+    {
+        thread_local std::vector<TagData const *> own;
+        own.clear();
+        for (std::size_t i = 0; i < mSize; ++i)
+        {
+            own.push_back(storage() + i);
+        }
+        std::sort(own.begin(), own.end(),
+            [] (TagData const * lhs, TagData const * rhs)
+        {
+            return lhs->key < rhs->key;
+        });
+
+        std::size_t const count = mDefaults ? mDefaults->tags.size() : 0;
+        std::size_t begin = 0;
+        std::size_t next = 0;
+        for (auto const & tag: own)
+        {
+            while (next < count && mDefaults->orderedTag(next).key < tag->key)
+            {
+                ++next;
+            }
+            if (begin < next)
+            {
+                run(*mDefaults, begin, next);
+            }
+            if (next < count && mDefaults->orderedTag(next).key == tag->key)
+            {
+                ++next;
+            }
+            visit(*tag);
+            begin = next;
+        }
+        if (begin < count)
+        {
+            run(*mDefaults, begin, count);
+        }
+    }
+
+private:
+
+    TagData * storage ()
+    {
+        return mOverflow.empty() ? mInline.tags : mOverflow.data();
+    }
+
+    TagData const * storage () const
+    {
+        return mOverflow.empty() ? mInline.tags : mOverflow.data();
+    }
+
+    // The inline tags are only written as they are set so that
+    // starting a record does not touch all of them.
+    union InlineTags
+    {
+        InlineTags ()
+        { }
+
+        TagData tags[inlineCapacity];
+    };
+
+    DefaultTags const * mDefaults;
+    std::size_t mReplacedDefaults;
+    InlineTags mInline;
+    std::vector<TagData> mOverflow;
+    std::size_t mSize;
+};
+
+// Appends " tag" for each tag in key name order. The default tags
+// between the other tags are copied a whole run at a time.
+inline void appendTagText (std::string & text, ActiveTags const & tags)
+{
+    tags.forEachRun([&text] (DefaultTags const & defaults,
+        std::size_t begin,
+        std::size_t end)
+    {
+        text += defaults.textRun(begin, end);
+    },
+    [&text] (TagData const & tag)
+    {
+        text += ' ';
+        text += tag.text;
+    });
+}
+
+inline void appendTagBinary (std::string & binary,
+    ActiveTags const & tags,
+    int & maxKeyId)
+{
+    // A default left out of a run has the key id of the tag that
+    // replaced it so the largest default key id is still right.
+    tags.forEachRun([&binary, &maxKeyId] (DefaultTags const & defaults,
+        std::size_t begin,
+        std::size_t end)
+    {
+        binary += defaults.binaryRun(begin, end);
+        maxKeyId = std::max(maxKeyId, defaults.maxKeyId);
+    },
+    [&binary, &maxKeyId] (TagData const & tag)
+    {
+        tag.encode(binary);
+        maxKeyId = std::max(maxKeyId, tag.keyId);
+    });
+}
+
+// The context tags of the current thread from the outermost scope
+// to the innermost. Each record gets these after the default tags
+// and before the tags given to the call.
+inline std::vector<Tag const *> & getLogContext ()
+{
+    thread_local std::vector<Tag const *> tags;
+    return tags;
+}
+
+// Adds tags to every record logged by the current thread while
+// the context is in scope. The tags are kept by value inside the
+// context so that no memory is allocated.
+template <typename... TagTs>
+class ScopedLogContext
+{
+public:
+    static_assert((std::is_base_of_v<Tag, TagTs> && ...));
+
+    ScopedLogContext (TagTs const &... tags)
+    : mTags(tags...)
+    {
+        std::apply([] (auto const &... tag)
+        {
+            (getLogContext().push_back(&tag), ...);
+        }, mTags);
+    }
+
+    ~ScopedLogContext ()
+    {
+        auto & context = getLogContext();
+        context.resize(context.size() - sizeof...(TagTs));
+    }
+
+    ScopedLogContext (ScopedLogContext const & other) = delete;
+    ScopedLogContext & operator = (ScopedLogContext const & rhs) = delete;
+
+private:
+    std::tuple<TagTs...> mTags;
+};
+
+// A copy of the current thread's context tags that can be taken
+// along to another thread. Copying clones the tags because the
+// scopes which hold them can end before the other thread is done.
+class LogContextCopy
+{
+public:
+    LogContextCopy ()
+    {
+        for (auto const & tag: getLogContext())
+        {
+            mTags.push_back(tag->clone());
+        }
+    }
+
+    std::vector<std::shared_ptr<Tag const>> const & tags () const
+    {
+        return mTags;
+    }
+
+private:
+    std::vector<std::shared_ptr<Tag const>> mTags;
+};
+
+// Puts a copied context in place on another thread.
+template <>
+class ScopedLogContext<LogContextCopy>
+{
+public:
+    ScopedLogContext (LogContextCopy const & copy)
+    : mCount(copy.tags().size())
+    {
+        for (auto const & tag: copy.tags())
+        {
+            getLogContext().push_back(tag.get());
+        }
+    }
+
+    ~ScopedLogContext ()
+    {
+        auto & context = getLogContext();
+        context.resize(context.size() - mCount);
+    }
+
+    ScopedLogContext (ScopedLogContext const & other) = delete;
+    ScopedLogContext & operator = (ScopedLogContext const & rhs) = delete;
+
+private:
+    std::size_t mCount;
+};
+
+struct FilterClause
+{
+    std::vector<std::shared_ptr<Tag const>> normalLiterals;
+    std::vector<std::shared_ptr<Tag const>> invertedLiterals;
+};
+
+// The filter clauses flattened into a single list of literals so
+// that each record can be checked without map lookups or virtual
+// calls. This is rebuilt whenever the filter clauses change and
+// refers to the literal tags held by the clauses.
+class CompiledFilter
+{
+public:
+    void build (std::map<int, FilterClause> const & clauses)
+    {
+        mLiterals.clear();
+        mClauses.clear();
+        for (auto const & clause: clauses)
+        {
+            CompiledClause compiled;
+            compiled.begin = mLiterals.size();
+            addLiterals(clause.second.normalLiterals);
+            compiled.invertedBegin = mLiterals.size();
+            addLiterals(clause.second.invertedLiterals);
+            compiled.end = mLiterals.size();
+            mClauses.push_back(compiled);
+        }
+    }
+
+    // A record is allowed when there are no clauses or when any
+    // clause has all of its normal literals present and matching
+    // and none of its inverted literals present and matching.
+    bool allows (ActiveTags const & tags) const
+    {
+        if (mClauses.empty())
+        {
+            return true;
+        }
+        for (auto const & clause: mClauses)
+        {
+            if (clauseMatches(clause, tags))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct CompiledClause
+    {
+        std::size_t begin;
+        std::size_t invertedBegin;
+        std::size_t end;
+    };
+
+    void addLiterals (std::vector<std::shared_ptr<Tag const>> const & literals)
+    {
+        std::size_t first = mLiterals.size();
+        for (auto const & literal: literals)
+        {
+            mLiterals.push_back(literal->data());
+        }
+        std::sort(mLiterals.begin() + first, mLiterals.end(),
+            [] (TagData const & lhs, TagData const & rhs)
+        {
+            return lhs.keyId < rhs.keyId;
+        });
+    }
+
+    bool clauseMatches (CompiledClause const & clause,
+        ActiveTags const & tags) const
+    {
+        for (std::size_t i = clause.begin; i < clause.invertedBegin; ++i)
+        {
+            TagData const * active = tags.find(mLiterals[i].keyId);
+            if (not active || not active->matches(mLiterals[i]))
+            {
+                return false;
+            }
+        }
+        for (std::size_t i = clause.invertedBegin; i < clause.end; ++i)
+        {
+            TagData const * active = tags.find(mLiterals[i].keyId);
+            if (active && active->matches(mLiterals[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<TagData> mLiterals;
+    std::vector<CompiledClause> mClauses;
+};
+
+// A record holds the text line, the binary encoding, or both
+// depending on what the outputs need. The record only refers to
+// the text and binary data which are owned by whoever built it.
+struct LogRecord
+{
+    std::string_view line;
+    std::string_view binary;
+    int maxKeyId {-1};
+    bool flush {false};
+};
+
+enum class OutputFormat
+{
+    Text,
+    Binary
+};
+
+// Counters for one output. They only change while the output's
+// lock is held so each change is a plain load and store.
+class OutputStats
+{
+public:
+    // Bucket i counts the sends that took less than 2^i
+    // nanoseconds and at least half of that.
+    static constexpr std::size_t latencyBuckets = 32;
+
+    // Reading the clock costs about as much as a small send so only
+    // one send in every latencySampling is timed.
+    static constexpr unsigned int latencySampling = 16;
+
+    bool timeNextSend ()
+    {
+        return mSends++ % latencySampling == 0;
+    }
+
+    void recordSend (std::size_t lines, std::size_t bytes)
+    {
+        add(mLines, lines);
+        add(mBytes, bytes);
+    }
+
+    void recordLatency (std::chrono::nanoseconds latency)
+    {
+        auto const ns = static_cast<unsigned long long>(
+            std::max<std::int64_t>(latency.count(), 0));
+        std::size_t const bucket = std::min<std::size_t>(
+            std::bit_width(ns), latencyBuckets - 1);
+        add(mLatency[bucket], 1);
+    }
+
+    void recordLockWait (std::chrono::nanoseconds wait)
+    {
+        add(mContended, 1);
+        add(mLockWait, static_cast<unsigned long long>(wait.count()));
+    }
+
+    void recordDrop (std::size_t bytes)
+    {
+        add(mDroppedBytes, bytes);
+    }
+
+    unsigned long long lines () const
+    {
+        return mLines.load(std::memory_order_relaxed);
+    }
+
+    unsigned long long bytes () const
+    {
+        return mBytes.load(std::memory_order_relaxed);
+    }
+
+    unsigned long long contendedLocks () const
+    {
+        return mContended.load(std::memory_order_relaxed);
+    }
+
+    std::chrono::nanoseconds lockWait () const
+    {
+        return std::chrono::nanoseconds(
+            mLockWait.load(std::memory_order_relaxed));
+    }
+
+    // The bytes the output had to leave out because
+    // they could not be written.
+    unsigned long long droppedBytes () const
+    {
+        return mDroppedBytes.load(std::memory_order_relaxed);
+    }
+
+    std::array<unsigned long long, latencyBuckets> latency () const
+    {
+        std::array<unsigned long long, latencyBuckets> counts;
+        for (std::size_t i = 0; i < latencyBuckets; ++i)
+        {
+            counts[i] = mLatency[i].load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+private:
+    static void add (std::atomic<unsigned long long> & counter,
+        unsigned long long amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount,
+            std::memory_order_relaxed);
+    }
+
+    unsigned int mSends {0};
+    std::atomic<unsigned long long> mLines {0};
+    std::atomic<unsigned long long> mBytes {0};
+    std::atomic<unsigned long long> mContended {0};
+    std::atomic<unsigned long long> mLockWait {0};
+    std::atomic<unsigned long long> mDroppedBytes {0};
+    std::array<std::atomic<unsigned long long>, latencyBuckets> mLatency {};
+};
+
+class Output
+{
+public:
+    virtual ~Output () = default;
+    Output (Output const & other) = delete;
+    Output (Output && other) = delete;
+
+    virtual std::unique_ptr<Output> clone () const = 0;
+
+    // Identifies the output in the logging statistics.
+    virtual std::string name () const
+    {
+        return "output";
+    }
+
+    virtual OutputFormat format () const
+    {
+        return OutputFormat::Text;
+    }
+
+    virtual void sendLine (std::string_view line) = 0;
+
+    // Outputs that can write several lines at once more cheaply
+    // than one at a time override this.
+    virtual void sendLines (std::span<std::string_view const> lines)
+    {
+        for (auto const & line: lines)
+        {
+            sendLine(line);
+        }
+    }
+
+    virtual void sendRecord (LogRecord const & record)
+    {
+        sendLine(record.line);
+    }
+
+    virtual void flush ()
     { }
 
-    std::unique_ptr<Output> clone () const override
+    // Writes what the output holds and then waits until it
+    // has reached storage. Most outputs can only flush.
+    virtual void sync ()
+    {
+        flush();
+    }
+
+    // Called every so often even when no lines arrive so that an
+    // output can write lines it has been holding for too long.
+    virtual void flushIfDue (std::chrono::steady_clock::time_point)
+    { }
+
+    // Each output has its own lock so that lines sent to one
+    // output never interleave while other outputs stay free.
+    std::mutex & mutex ()
+    {
+        return mMutex;
+    }
+
+    OutputStats & stats ()
+    {
+        return mStats;
+    }
+
+    OutputStats const & stats () const
+    {
+        return mStats;
+    }
+
+    Output & operator = (Output const & rhs) = delete;
+    Output & operator = (Output && rhs) = delete;
+
+protected:
+    Output () = default;
+
+private:
+    std::mutex mMutex;
+    OutputStats mStats;
+};
+
+// Locks an output and counts the time spent waiting when
+// another thread already has the lock.
+class OutputLock
+{
+public:
+    OutputLock (Output & output)
+    : mLock(output.mutex(), std::try_to_lock)
+    {
+        if (not mLock.owns_lock())
+        {
+            auto const start = std::chrono::steady_clock::now();
+            mLock.lock();
+            output.stats().recordLockWait(
+                std::chrono::steady_clock::now() - start);
+        }
+    }
+
+private:
+    std::unique_lock<std::mutex> mLock;
+};
+
+// Decides if one more record may be written. A limit is shared by
+// every thread and is checked without any locks.
+class LogLimit
+{
+public:
+    virtual ~LogLimit () = default;
+
+    virtual bool allow () = 0;
+
+    // Undoes an allow that let a record through when something
+    // checked after this limit leaves the record out after all.
+    virtual void giveBack () = 0;
+
+    unsigned long long limitedCount () const
+    {
+        return mLimited.load(std::memory_order_relaxed);
+    }
+
+protected:
+    LogLimit ()
+    : mLimited(0)
+    { }
+
+    bool countLimited ()
+    {
+        mLimited.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    std::atomic<unsigned long long> mLimited;
+};
+
+// A token bucket that holds up to burst tokens and gains perSecond
+// tokens every second. The bucket is kept as the time at which it
+// will be full again so that a single compare and swap takes
+// a token.
+class TokenBucket
+{
+public:
+    TokenBucket (double perSecond, double burst)
+    : mInterval(static_cast<std::int64_t>(1e9 / std::max(perSecond, 1e-9))),
+    mCapacity(static_cast<std::int64_t>(
+        mInterval * std::max(burst, 1.0))),
+    mFullAt(0)
+    { }
+
+    bool take (std::int64_t now = nowNanoseconds())
+    {
+        std::int64_t fullAt = mFullAt.load(std::memory_order_relaxed);
+        while (true)
+        {
+            std::int64_t const next = std::max(fullAt, now) + mInterval;
+            if (next - now > mCapacity)
+            {
+                return false;
+            }
+            if (mFullAt.compare_exchange_weak(fullAt, next,
+                std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+
+    // Puts back a token that take gave out.
+    void giveBack ()
+    {
+        mFullAt.fetch_sub(mInterval, std::memory_order_relaxed);
+    }
+
+    static std::int64_t nowNanoseconds ()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::int64_t const mInterval;
+    std::int64_t const mCapacity;
+    std::atomic<std::int64_t> mFullAt;
+};
+
+class RateLimit : public LogLimit
+{
+public:
+    RateLimit (double perSecond, double burst)
+    : mBucket(perSecond, burst)
+    { }
+
+    bool allow () override
+    {
+        return mBucket.take() || countLimited();
+    }
+
+    void giveBack () override
+    {
+        mBucket.giveBack();
+    }
+
+private:
+    TokenBucket mBucket;
+};
+
+// Lets the first record and then every oneIn record through.
+class SampleLimit : public LogLimit
+{
+public:
+    SampleLimit (unsigned int oneIn)
+    : mOneIn(std::max(oneIn, 1u)), mCount(0)
+    { }
+
+    bool allow () override
+    {
+        return mCount.fetch_add(1, std::memory_order_relaxed) %
+            mOneIn == 0 || countLimited();
+    }
+
+    // The next record takes the place of the one given back.
+    void giveBack () override
+    {
+        mCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    unsigned int const mOneIn;
+    std::atomic<unsigned long long> mCount;
+};
+
+// A copy of a tag kept by the configuration along with its data
+// so that records can be matched against it without virtual calls.
+// The data refers to the copy which is shared with every later
+// configuration.
+struct StoredTag
+{
+    explicit StoredTag (Tag const & tag)
+    : owner(tag.clone()), data(owner->data())
+    { }
+
+    std::shared_ptr<Tag const> owner;
+    TagData data;
+};
+
+// A limit applies to records with a tag matching the limit's tag.
+// The limit itself is shared between configurations so its state
+// carries over when the configuration changes.
+struct LimitRule
+{
+    StoredTag tag;
+    std::shared_ptr<LogLimit> limit;
+};
+
+// The whole logging configuration. A configuration is never
+// changed once it has been published. Each change makes a new copy
+// so that loggers can read the configuration without any locks.
+struct LogConfig
+{
+    std::map<int, std::shared_ptr<Tag const>> defaultTags;
+    DefaultTags renderedDefaults;
+    std::map<int, FilterClause> filterClauses;
+    CompiledFilter filter;
+    std::vector<StoredTag> flushTags;
+    std::map<int, LimitRule> limits;
+    std::vector<std::shared_ptr<Output>> outputs;
+};
+
+inline std::atomic<std::shared_ptr<LogConfig const>> & getLogConfig ()
+{
+    static std::atomic<std::shared_ptr<LogConfig const>> config(
+        std::make_shared<LogConfig const>());
+    return config;
+}
+
+inline std::atomic<unsigned long long> & getLogConfigVersion ()
+{
+    static std::atomic<unsigned long long> version {1};
+    return version;
+}
+
+// Each thread keeps the configuration it last used and only loads
+// the shared pointer again when the version changes. This means a
+// logger normally pays for a single atomic load.
+inline std::shared_ptr<LogConfig const> const & currentLogConfig ()
+{
+    thread_local std::shared_ptr<LogConfig const> config;
+    thread_local unsigned long long version {0};
+
+    unsigned long long latest =
+        getLogConfigVersion().load(std::memory_order_acquire);
+    if (latest != version)
+    {
+        config = getLogConfig().load();
+        version = latest;
+    }
+    return config;
+}
+
+template <typename ChangeT>
+void updateLogConfig (ChangeT change)
+{
+    static std::mutex m;
+
+    const std::lock_guard<std::mutex> lock(m);
+    auto config = std::make_shared<LogConfig>(*getLogConfig().load());
+    change(*config);
+    config->filter.build(config->filterClauses);
+    getLogConfig().store(std::move(config));
+    getLogConfigVersion().fetch_add(1, std::memory_order_release);
+}
+
+inline void addDefaultTag (Tag const & tag)
+{
+    std::shared_ptr<Tag const> defaultTag = tag.clone();
+    updateLogConfig([&defaultTag] (LogConfig & config)
+    {
+        config.defaultTags[defaultTag->keyId()] = defaultTag;
+        config.renderedDefaults.build(config.defaultTags);
+    });
+}
+
+inline int createFilterClause ()
+{
+    static int currentId = 0;
+
+    int id = 0;
+    updateLogConfig([&id] (LogConfig & config)
+    {
+        id = ++currentId;
+        config.filterClauses[id] = FilterClause();
+    });
+    return id;
+}
+
+inline void addFilterLiteral (int filterId,
+    Tag const & tag,
+    bool normal = true)
+{
+    std::shared_ptr<Tag const> literal = tag.clone();
+    updateLogConfig([filterId, normal, &literal] (LogConfig & config)
+    {
+        auto & clauses = config.filterClauses;
+        if (clauses.contains(filterId))
+        {
+            if (normal)
+            {
+                clauses[filterId].normalLiterals.push_back(literal);
+            }
+            else
+            {
+                clauses[filterId].invertedLiterals.push_back(literal);
+            }
+        }
+    });
+}
+
+inline void clearFilterClause (int filterId)
+{
+    updateLogConfig([filterId] (LogConfig & config)
+    {
+        config.filterClauses.erase(filterId);
+    });
+}
+
+inline void addFlushTag (Tag const & tag)
+{
+    // Records with a tag matching a flush tag are flushed to
+    // every output as soon as they are written.
+    StoredTag flushTag(tag);
+    updateLogConfig([&flushTag] (LogConfig & config)
+    {
+        config.flushTags.push_back(flushTag);
+    });
+}
+
+inline int addLogLimit (Tag const & tag, std::shared_ptr<LogLimit> limit)
+{
+    static int currentId = 0;
+
+    StoredTag limitTag(tag);
+    int id = 0;
+    updateLogConfig([&id, &limitTag, &limit] (LogConfig & config)
+    {
+        id = ++currentId;
+        config.limits.insert_or_assign(id, LimitRule {limitTag, limit});
+    });
+    return id;
+}
+
+// Records with a tag matching tag are written at most perSecond
+// times each second on average with bursts of up to burst records.
+inline int addRateLimit (Tag const & tag,
+    double perSecond,
+    double burst = 0)
+{
+    return addLogLimit(tag, std::make_shared<RateLimit>(
+        perSecond, burst > 0 ? burst : perSecond));
+}
+
+// Only one in oneIn records with a tag matching tag is written.
+inline int addSampling (Tag const & tag, unsigned int oneIn)
+{
+    return addLogLimit(tag, std::make_shared<SampleLimit>(oneIn));
+}
+
+inline void removeLogLimit (int limitId)
+{
+    updateLogConfig([limitId] (LogConfig & config)
+    {
+        config.limits.erase(limitId);
+    });
+}
+
+// The number of records left out so far because of a limit.
+inline unsigned long long limitedLogCount (int limitId)
+{
+    auto const & config = currentLogConfig();
+    auto rule = config->limits.find(limitId);
+    if (rule == config->limits.end())
+    {
+        return 0;
+    }
+    return rule->second.limit->limitedCount();
+}
+
+// Wakes up every tickInterval and lets each output write the lines
+// it has been holding for longer than it should. Without this, a
+// logger that goes quiet would keep its last lines in a buffer.
+class OutputTimer
+{
+public:
+    static constexpr std::chrono::milliseconds tickInterval {100};
+
+    OutputTimer ()
+    : mStopping(false)
+    {
+        // The outputs must outlive the timer thread so make sure
+        // they are constructed first and therefore destroyed last.
+        getLogConfig();
+        mThread = std::thread(&OutputTimer::run, this);
+    }
+
+    OutputTimer (OutputTimer const & other) = delete;
+    OutputTimer (OutputTimer && other) = delete;
+
+    ~OutputTimer ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_one();
+        mThread.join();
+    }
+
+    OutputTimer & operator = (OutputTimer const & rhs) = delete;
+    OutputTimer & operator = (OutputTimer && rhs) = delete;
+
+private:
+    void run ()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (not mWake.wait_for(lock, tickInterval, [this]
+        {
+            return mStopping;
+        }))
+        {
+            lock.unlock();
+            auto const now = std::chrono::steady_clock::now();
+            auto const config = getLogConfig().load();
+            for (auto const & output: config->outputs)
+            {
+                OutputLock outputLock(*output);
+                output->flushIfDue(now);
+            }
+            lock.lock();
+        }
+    }
+
+    bool mStopping;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::thread mThread;
+};
+
+// The timer starts along with the first output.
+inline void startOutputTimer ()
+{
+    static OutputTimer timer;
+}
+
+inline void addLogOutput (Output const & output)
+{
+    startOutputTimer();
+    std::shared_ptr<Output> newOutput = output.clone();
+    updateLogConfig([&newOutput] (LogConfig & config)
+    {
+        config.outputs.push_back(newOutput);
+    });
+}
+
+inline void flushOutputs (std::vector<std::shared_ptr<Output>> const & outputs)
+{
+    for (auto const & output: outputs)
+    {
+        OutputLock lock(*output);
+        output->flush();
+    }
+}
+
+inline void flushOutputs ()
+{
+    auto config = currentLogConfig();
+    flushOutputs(config->outputs);
+}
+
+// Like flushOutputs but also waits until the outputs that write
+// to files have their lines on the disk.
+inline void syncOutputs ()
+{
+    auto config = currentLogConfig();
+    for (auto const & output: config->outputs)
+    {
+        OutputLock lock(*output);
+        output->sync();
+    }
+}
+
+// Replaces the outputs with the ones given and
+// gives back the outputs that were in use.
+inline void swapLogOutputs (std::vector<std::shared_ptr<Output>> & outputs)
+{
+    startOutputTimer();
+    updateLogConfig([&outputs] (LogConfig & config)
+    {
+        std::swap(config.outputs, outputs);
+    });
+    // Threads that have not logged since keep the old outputs alive
+    // in their cached config. Whatever those outputs hold back gets
+    // written now instead of whenever the threads end.
+    flushOutputs(outputs);
+}
+
+class FileOutput : public Output
+{
+public:
+    static constexpr std::size_t maxHeldBuffers = 4;
+
+    FileOutput (std::string_view dir)
+    : mOutputDir(dir),
+    mFileNamePattern("application{}.log"),
+    mMaxSize(0),
+    mRolloverCount(0),
+    mBufferSize(64 * 1024),
+    mFlushInterval(std::chrono::milliseconds(1000)),
+    mFile(nullptr),
+    mFileSize(0)
+    { }
+
+    FileOutput (FileOutput const & rhs)
+    : mOutputDir(rhs.mOutputDir),
+    mFileNamePattern(rhs.mFileNamePattern),
+    mMaxSize(rhs.mMaxSize),
+    mRolloverCount(rhs.mRolloverCount),
+    mBufferSize(rhs.mBufferSize),
+    mFlushInterval(rhs.mFlushInterval),
+    mFile(nullptr),
+    mFileSize(0)
+    { }
+
+    FileOutput (FileOutput && rhs)
+    : mOutputDir(rhs.mOutputDir),
+    mFileNamePattern(rhs.mFileNamePattern),
+    mMaxSize(rhs.mMaxSize),
+    mRolloverCount(rhs.mRolloverCount),
+    mBufferSize(rhs.mBufferSize),
+    mFlushInterval(rhs.mFlushInterval),
+    mBuffer(std::move(rhs.mBuffer)),
+    mLastFlush(rhs.mLastFlush),
+    mFile(rhs.mFile),
+    mFileSize(rhs.mFileSize)
+    {
+        // The next rollover must not overlap the files still being
+        // shifted by the rotation that the other output started.
+        if (rhs.mRotation.joinable())
+        {
+            rhs.mRotation.join();
+        }
+        rhs.mFile = nullptr;
+    }
+
+    ~FileOutput ()
+    {
+        flush();
+        if (mFile)
+        {
+            std::fclose(mFile);
+        }
+        if (mRotation.joinable())
+        {
+            mRotation.join();
+        }
+    }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new FileOutput(*this));
+    }
+
+    std::string name () const override
+    {
+        return fileName("").string();
+    }
+
+    std::string & namePattern ()
+    {
+        return mFileNamePattern;
+    }
+
+    std::size_t & maxSize ()
+    {
+        return mMaxSize;
+    }
+
+    unsigned int & rolloverCount ()
+    {
+        return mRolloverCount;
+    }
+
+    std::size_t & bufferSize ()
+    {
+        return mBufferSize;
+    }
+
+    std::chrono::milliseconds & flushInterval ()
+    {
+        return mFlushInterval;
+    }
+
+    // The bytes left out because the file could not be written.
+    unsigned long long droppedBytes () const
+    {
+        return stats().droppedBytes();
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        if (mBuffer.empty())
+        {
+            mBuffer.reserve(mBufferSize);
+        }
+        mBuffer += line;
+        mBuffer += '\n';
+
+        if (mBuffer.size() >= mBufferSize ||
+            std::chrono::steady_clock::now() - mLastFlush >= mFlushInterval)
+        {
+            flush();
+        }
+    }
+
+    void sendLines (std::span<std::string_view const> lines) override
+    {
+        std::size_t total = mBuffer.size();
+        for (auto const & line: lines)
+        {
+            total += line.size() + 1;
+        }
+#if not defined(_WIN32)
+        // A batch that would fill the buffer anyway goes straight to
+        // the file with writev instead of being copied first. When
+        // the batch needs a rollover, it is written line by line.
+        // The file gets opened first because that reads its size.
+        if (total >= mBufferSize && (mFile || open()) &&
+            (mMaxSize == 0 || mFileSize == 0 ||
+            mFileSize + total <= mMaxSize))
+        {
+            mLastFlush = std::chrono::steady_clock::now();
+            writeLines(lines);
+            return;
+        }
+#endif
+        if (mBuffer.empty())
+        {
+            mBuffer.reserve(mBufferSize);
+        }
+        for (auto const & line: lines)
+        {
+            mBuffer += line;
+            mBuffer += '\n';
+            if (mBuffer.size() >= mBufferSize)
+            {
+                flush();
+            }
+        }
+        if (std::chrono::steady_clock::now() - mLastFlush >= mFlushInterval)
+        {
+            flush();
+        }
+    }
+
+    void flush () override
+    {
+        mLastFlush = std::chrono::steady_clock::now();
+        if (mBuffer.empty())
+        {
+            return;
+        }
+        if (not mFile && not open())
+        {
+            dropIfTooLarge();
+            return;
+        }
+        std::string_view const data = encodeBuffer(mBuffer);
+        if (mMaxSize > 0 && mFileSize > 0 &&
+            mFileSize + data.size() > mMaxSize)
+        {
+            rollover();
+            if (not open())
+            {
+                dropIfTooLarge();
+                return;
+            }
+        }
+        std::uint64_t const offset = mFileSize;
+        std::size_t const written = writeData(data);
+        mFileSize += written;
+        if (written == data.size())
+        {
+            mBuffer.clear();
+            bufferWritten(offset);
+        }
+        else if (data.data() == mBuffer.data())
+        {
+            // The rest gets another try with the next flush.
+            mBuffer.erase(0, written);
+            dropIfTooLarge();
+        }
+        else if (written > 0)
+        {
+            // An encoded buffer cannot be finished later
+            // once part of it has been written.
+            dropBuffer();
+        }
+        else
+        {
+            dropIfTooLarge();
+        }
+    }
+
+    void flushIfDue (std::chrono::steady_clock::time_point now) override
+    {
+        if (not mBuffer.empty() && now - mLastFlush >= mFlushInterval)
+        {
+            flush();
+        }
+    }
+
+    void sync () override
+    {
+        flush();
+        if (mFile)
+        {
+#if defined(_WIN32)
+            _commit(_fileno(mFile));
+#else
+            fsync(fileno(mFile));
+#endif
+        }
+    }
+
+protected:
+    // The {} in the name pattern is empty for the current file and
+    // holds the generation number for files that have rolled over.
+    std::filesystem::path fileName (std::string_view generation) const
+    {
+        return fileName(mOutputDir, mFileNamePattern, generation);
+    }
+
+    static std::filesystem::path fileName (
+        std::filesystem::path const & dir,
+        std::string pattern,
+        std::string_view generation)
+    {
+        auto pos = pattern.find("{}");
+        if (pos != std::string::npos)
+        {
+            pattern.replace(pos, 2, generation);
+        }
+        return dir / pattern;
+    }
+
+    bool open ()
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(mOutputDir, ec);
+        auto const name = fileName("");
+        mFile = std::fopen(name.string().c_str(), "a");
+        if (not mFile)
+        {
+            return false;
+        }
+        // We do our own buffering so that each flush
+        // becomes a single write.
+        std::setvbuf(mFile, nullptr, _IONBF, 0);
+
+        // This is the only time the size is read from the file
+        // system. After this, the size is tracked with each write.
+        mFileSize = std::filesystem::file_size(name, ec);
+        if (ec)
+        {
+            mFileSize = 0;
+        }
+        bool const newFile = mFileSize == 0;
+        if (newFile)
+        {
+            std::string const header = fileHeader();
+            mFileSize += std::fwrite(header.data(), 1, header.size(), mFile);
+        }
+        fileOpened(newFile);
+        return true;
+    }
+
+    // Returns how much got written which is less than
+    // the whole data only when the file has an error.
+    std::size_t writeData (std::string_view data)
+    {
+        std::size_t written = 0;
+        while (written < data.size())
+        {
+            errno = 0;
+            std::size_t const remaining = data.size() - written;
+            std::size_t const count = std::fwrite(data.data() + written,
+                1, remaining, mFile);
+            written += count;
+            if (count < remaining)
+            {
+                std::clearerr(mFile);
+                if (errno != EINTR)
+                {
+                    break;
+                }
+            }
+        }
+        return written;
+    }
+
+    // Lines that cannot be written are only held on to until they
+    // fill maxHeldBuffers buffers and are then counted and dropped.
+    void dropIfTooLarge ()
+    {
+        if (mBuffer.size() >= maxHeldBuffers * std::max<std::size_t>(
+            mBufferSize, 1))
+        {
+            dropBuffer();
+        }
+    }
+
+    void dropBuffer ()
+    {
+        stats().recordDrop(mBuffer.size());
+        mBuffer.clear();
+        bufferDropped();
+    }
+
+    // Derived outputs that put more than the lines in the buffer
+    // learn here that the buffer never reached the file.
+    virtual void bufferDropped ()
+    { }
+
+#if not defined(_WIN32)
+    // Writes the buffer and then the lines with as few
+    // system calls as possible. Whatever cannot be written
+    // is kept in the buffer for the next flush.
+    void writeLines (std::span<std::string_view const> lines)
+    {
+        static char const newline = '\n';
+        mVectors.clear();
+        if (not mBuffer.empty())
+        {
+            mVectors.push_back({mBuffer.data(), mBuffer.size()});
+        }
+        for (auto const & line: lines)
+        {
+            mVectors.push_back({const_cast<char *>(line.data()), line.size()});
+            mVectors.push_back({const_cast<char *>(&newline), 1});
+        }
+
+        int const fd = fileno(mFile);
+        iovec * vectors = mVectors.data();
+        std::size_t count = mVectors.size();
+        while (count > 0)
+        {
+            ssize_t written = ::writev(fd, vectors,
+                static_cast<int>(std::min<std::size_t>(count, IOV_MAX)));
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                std::string rest;
+                rest.reserve(mBufferSize);
+                for (; count > 0; --count, ++vectors)
+                {
+                    rest.append(static_cast<char const *>(vectors->iov_base),
+                        vectors->iov_len);
+                }
+                mBuffer.swap(rest);
+                dropIfTooLarge();
+                return;
+            }
+            mFileSize += written;
+
+            // Skip past whatever got written and continue
+            // with the rest.
+            while (count > 0 &&
+                static_cast<std::size_t>(written) >= vectors->iov_len)
+            {
+                written -= vectors->iov_len;
+                ++vectors;
+                --count;
+            }
+            if (count > 0)
+            {
+                vectors->iov_base =
+                    static_cast<char *>(vectors->iov_base) + written;
+                vectors->iov_len -= written;
+            }
+        }
+        mBuffer.clear();
+    }
+#endif
+
+    // Derived outputs can change the buffered lines
+    // right before they get written.
+    virtual std::string_view encodeBuffer (std::string_view buffer)
+    {
+        return buffer;
+    }
+
+    // Derived outputs can start each new file with a header.
+    virtual std::string fileHeader () const
+    {
+        return {};
+    }
+
+    // Derived outputs can end each file with a trailer which gets
+    // written once nothing more goes into the file.
+    virtual std::string fileTrailer () const
+    {
+        return {};
+    }
+
+    // Called each time the file gets opened. A file that is not new
+    // was left by an earlier run and this output appends to it.
+    virtual void fileOpened (bool)
+    { }
+
+    // Called once all that encodeBuffer gave back for the buffer has
+    // been written to the file starting at offset.
+    virtual void bufferWritten (std::uint64_t)
+    { }
+
+    void finishFile ()
+    {
+        if (mFile)
+        {
+            std::string const trailer = fileTrailer();
+            mFileSize += writeData(trailer);
+        }
+    }
+
+    void rollover ()
+    {
+        finishFile();
+        std::fclose(mFile);
+        mFile = nullptr;
+        mFileSize = 0;
+
+        // Only a single rename happens here. The older generations
+        // are shifted by another thread so that the logging thread
+        // can continue with the other outputs.
+        if (mRotation.joinable())
+        {
+            mRotation.join();
+        }
+        std::error_code ec;
+        auto const staging = fileName("-rolling");
+        std::filesystem::rename(fileName(""), staging, ec);
+        if (ec)
+        {
+            return;
+        }
+
+        // The thread gets its own copies of the settings because
+        // the logging thread can change them while it runs.
+        mRotation = std::thread([dir = mOutputDir,
+            pattern = mFileNamePattern,
+            count = mRolloverCount,
+            staging] ()
+        {
+            auto name = [&dir, &pattern] (unsigned int generation)
+            {
+                return fileName(dir, pattern, std::to_string(generation));
+            };
+            std::error_code ec;
+            if (count == 0)
+            {
+                std::filesystem::remove(staging, ec);
+                return;
+            }
+            std::filesystem::remove(name(count), ec);
+            for (unsigned int i = count - 1; i > 0; --i)
+            {
+                std::filesystem::rename(name(i), name(i + 1), ec);
+            }
+            std::filesystem::rename(staging, name(1), ec);
+        });
+    }
+
+    std::filesystem::path mOutputDir;
+    std::string mFileNamePattern;
+    std::size_t mMaxSize;
+    unsigned int mRolloverCount;
+    std::size_t mBufferSize;
+    std::chrono::milliseconds mFlushInterval;
+    std::string mBuffer;
+    std::chrono::steady_clock::time_point mLastFlush;
+    std::FILE * mFile;
+    std::size_t mFileSize;
+    std::thread mRotation;
+#if not defined(_WIN32)
+    std::vector<iovec> mVectors;
+#endif
+};
+
+class StreamOutput : public Output
+{
+public:
+    StreamOutput (std::ostream & stream)
+    : mStream(stream)
+    { }
+
+    StreamOutput (StreamOutput const & rhs)
+    : mStream(rhs.mStream)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new StreamOutput(*this));
+    }
+
+    std::string name () const override
+    {
+        return "stream";
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        mStream << line << std::endl;
+    }
+
+    // The stream is only flushed once for the whole batch.
+    void sendLines (std::span<std::string_view const> lines) override
+    {
+        for (auto const & line: lines)
+        {
+            mStream << line << '\n';
+        }
+        mStream.flush();
+    }
+
+    void flush () override
+    {
+        mStream.flush();
+    }
+
+protected:
+    std::ostream & mStream;
+};
+
+// The start of a mapped ring file. The data area follows the header
+// and holds the lines one after the other, wrapping around at the
+// end. Both positions only ever grow and are taken modulo the
+// capacity to find a byte in the data area.
+struct MappedRingHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t capacity;
+    // The end of the line being written. Bytes older than
+    // reserved - capacity may have been overwritten.
+    std::uint64_t reserved;
+    // The end of the last line that was completely written.
+    std::uint64_t committed;
+    char padding[32];
+};
+
+static_assert(sizeof(MappedRingHeader) == 64);
+
+constexpr char mappedRingMagic[] = "MMRG";
+constexpr std::uint32_t mappedRingVersion = 1;
+
+#if not defined(_WIN32)
+// Writes lines into a memory mapped file that is used as a circular
+// buffer. Sending a line only copies memory so there is no system
+// call for each line. The pages stay with the operating system when
+// the process crashes, and recoverMappedRing reads back the newest
+// lines that are still in the file.
+class MappedRingOutput : public Output
+{
+public:
+    MappedRingOutput (std::string_view dir)
+    : mOutputDir(dir),
+    mFileName("application.ring"),
+    mCapacity(4 * 1024 * 1024),
+    mMapping(nullptr),
+    mMappedSize(0)
+    { }
+
+    MappedRingOutput (MappedRingOutput const & rhs)
+    : mOutputDir(rhs.mOutputDir),
+    mFileName(rhs.mFileName),
+    mCapacity(rhs.mCapacity),
+    mMapping(nullptr),
+    mMappedSize(0)
+    { }
+
+    ~MappedRingOutput ()
+    {
+        if (mMapping)
+        {
+            munmap(mMapping, mMappedSize);
+        }
+    }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new MappedRingOutput(*this));
+    }
+
+    std::string name () const override
+    {
+        return (mOutputDir / mFileName).string();
+    }
+
+    std::string & fileName ()
+    {
+        return mFileName;
+    }
+
+    std::size_t & capacity ()
+    {
+        return mCapacity;
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        if (not mMapping && not open())
+        {
+            return;
+        }
+
+        // Only the end of a line too big for the ring is kept.
+        std::size_t const capacity = header().capacity;
+        if (line.size() >= capacity)
+        {
+            line.remove_prefix(line.size() - capacity + 1);
+        }
+        std::uint64_t const start = committed().load(
+            std::memory_order_relaxed);
+        std::uint64_t const end = start + line.size() + 1;
+        reserved().store(end, std::memory_order_release);
+        copyAt(start, line);
+        copyAt(end - 1, "\n");
+        committed().store(end, std::memory_order_release);
+    }
+
+    // Waits until the operating system has written the ring
+    // to the file.
+    void sync () override
+    {
+        if (mMapping)
+        {
+            msync(mMapping, mMappedSize, MS_SYNC);
+        }
+    }
+
+private:
+    bool open ()
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(mOutputDir, ec);
+        auto const name = mOutputDir / mFileName;
+        int fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        std::size_t const capacity = std::max<std::size_t>(mCapacity, 2);
+        std::size_t const size = sizeof(MappedRingHeader) + capacity;
+        struct stat info;
+        if (fstat(fd, &info) != 0 ||
+            (static_cast<std::size_t>(info.st_size) != size &&
+            ftruncate(fd, size) != 0))
+        {
+            ::close(fd);
+            return false;
+        }
+        void * mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        mMapping = static_cast<char *>(mapping);
+        mMappedSize = size;
+
+        // A ring left by an earlier run is kept so that its lines
+        // can still be recovered.
+        MappedRingHeader & ring = header();
+        if (std::memcmp(ring.magic, mappedRingMagic, sizeof(ring.magic)) != 0 ||
+            ring.version != mappedRingVersion ||
+            ring.capacity != capacity ||
+            ring.committed > ring.reserved)
+        {
+            std::memset(mMapping, 0, sizeof(MappedRingHeader));
+            std::memcpy(ring.magic, mappedRingMagic, sizeof(ring.magic));
+            ring.version = mappedRingVersion;
+            ring.capacity = capacity;
+        }
+        else if (ring.committed != ring.reserved)
+        {
+            // The earlier run stopped in the middle of a line.
+            ring.committed = ring.reserved;
+            sendLine("");
+        }
+        return true;
+    }
+
+    MappedRingHeader & header ()
+    {
+        return *reinterpret_cast<MappedRingHeader *>(mMapping);
+    }
+
+    std::atomic_ref<std::uint64_t> reserved ()
+    {
+        return std::atomic_ref<std::uint64_t>(header().reserved);
+    }
+
+    std::atomic_ref<std::uint64_t> committed ()
+    {
+        return std::atomic_ref<std::uint64_t>(header().committed);
+    }
+
+    void copyAt (std::uint64_t pos, std::string_view text)
+    {
+        std::size_t const capacity = header().capacity;
+        char * data = mMapping + sizeof(MappedRingHeader);
+        std::size_t const offset = pos % capacity;
+        std::size_t const first = std::min(text.size(), capacity - offset);
+        std::memcpy(data + offset, text.data(), first);
+        std::memcpy(data, text.data() + first, text.size() - first);
+    }
+
+    std::filesystem::path mOutputDir;
+    std::string mFileName;
+    std::size_t mCapacity;
+    char * mMapping;
+    std::size_t mMappedSize;
+};
+#endif // not _WIN32
+
+// Writes the newest complete lines of a mapped ring file to output
+// and no more than maxBytes of them. The file can be read while a
+// process is writing to it or after the process has crashed.
+inline bool recoverMappedRing (std::istream & input,
+    std::ostream & output,
+    std::size_t maxBytes = std::numeric_limits<std::size_t>::max())
+{
+    MappedRingHeader ring;
+    if (not input.read(reinterpret_cast<char *>(&ring), sizeof(ring)))
+    {
+        return false;
+    }
+    if (std::memcmp(ring.magic, mappedRingMagic, sizeof(ring.magic)) != 0 ||
+        ring.version != mappedRingVersion || ring.capacity == 0 ||
+        ring.committed > ring.reserved)
+    {
+        return false;
+    }
+    std::uint64_t const capacity = ring.capacity;
+    std::uint64_t const reserved = ring.reserved;
+    std::uint64_t const committed = ring.committed;
+    std::string data(capacity, '\0');
+    if (not input.read(data.data(), data.size()))
+    {
+        return false;
+    }
+
+    std::uint64_t const oldest = reserved > capacity ?
+        reserved - capacity : 0;
+    std::uint64_t start = std::max(oldest,
+        committed > maxBytes ? committed - maxBytes : 0);
+    if (start >= committed)
+    {
+        return true;
+    }
+    // Skip the first line when only its end is left.
+    if (start > 0 && not (start > oldest &&
+        data[(start - 1) % capacity] == '\n'))
+    {
+        while (start < committed && data[start % capacity] != '\n')
+        {
+            ++start;
+        }
+        ++start;
+    }
+    while (start < committed)
+    {
+        std::size_t const offset = start % capacity;
+        std::size_t const count = std::min<std::uint64_t>(
+            committed - start, capacity - offset);
+        output.write(data.data() + offset, count);
+        start += count;
+    }
+    return true;
+}
+
+// Formats timestamps such as 2022-06-25T20:01:05.123 in UTC.
+// The part up to the seconds is only formatted again when the
+// second changes. Each thread has its own cache.
+class TimestampCache
+{
+public:
+    TimestampCache ()
+    : mSeconds(std::chrono::sys_seconds::min())
+    {
+        std::fill(std::begin(mBuffer), std::end(mBuffer), '0');
+    }
+
+    std::string_view format (std::chrono::system_clock::time_point time)
+    {
+        auto const seconds =
+            std::chrono::floor<std::chrono::seconds>(time);
+        if (seconds != mSeconds)
+        {
+            mSeconds = seconds;
+            auto const days = std::chrono::floor<std::chrono::days>(seconds);
+            std::chrono::year_month_day const date(days);
+            std::chrono::hh_mm_ss const clock(seconds - days);
+
+            writeDigits(mBuffer, 4, static_cast<int>(date.year()));
+            mBuffer[4] = '-';
+            writeDigits(mBuffer + 5, 2, static_cast<unsigned>(date.month()));
+            mBuffer[7] = '-';
+            writeDigits(mBuffer + 8, 2, static_cast<unsigned>(date.day()));
+            mBuffer[10] = 'T';
+            writeDigits(mBuffer + 11, 2, clock.hours().count());
+            mBuffer[13] = ':';
+            writeDigits(mBuffer + 14, 2, clock.minutes().count());
+            mBuffer[16] = ':';
+            writeDigits(mBuffer + 17, 2, clock.seconds().count());
+            mBuffer[19] = '.';
+        }
+        auto const ms = std::chrono::duration_cast<
+            std::chrono::milliseconds>(time - seconds);
+        writeDigits(mBuffer + 20, 3, ms.count());
+
+        return std::string_view(mBuffer, sizeof(mBuffer));
+    }
+
+private:
+    static void writeDigits (char * dest, int width, long long value)
+    {
+        for (int i = width - 1; i >= 0; --i)
+        {
+            dest[i] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+
+    std::chrono::sys_seconds mSeconds;
+    char mBuffer[23];
+};
+
+inline TimestampCache & getTimestampCache ()
+{
+    thread_local TimestampCache cache;
+    return cache;
+}
+
+inline constexpr char binaryLogMagic[] = "MMLB";
+inline constexpr std::uint8_t binaryLogVersion = 1;
+inline constexpr char binaryKeyEntry = 'K';
+inline constexpr char binaryRecordEntry = 'R';
+
+// Writes records in the binary log format which can be turned
+// back into text with decodeBinaryLog. Key names are written
+// once in each file before the first record that uses them.
+class BinaryFileOutput : public FileOutput
+{
+public:
+    BinaryFileOutput (std::string_view dir)
+    : FileOutput(dir), mDefinedKeys(0)
+    {
+        mFileNamePattern = "application{}.mlog";
+    }
+
+    BinaryFileOutput (BinaryFileOutput const & rhs)
+    : FileOutput(rhs), mDefinedKeys(0)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new BinaryFileOutput(*this));
+    }
+
+    OutputFormat format () const override
+    {
+        return OutputFormat::Binary;
+    }
+
+    void sendLine (std::string_view) override
+    {
+        // Only records with a binary encoding can be written.
+    }
+
+    void sendRecord (LogRecord const & record) override
+    {
+        if (mBuffer.empty())
+        {
+            mBuffer.reserve(mBufferSize);
+        }
+        for (; mDefinedKeys <= record.maxKeyId; ++mDefinedKeys)
+        {
+            appendKey(mBuffer, mDefinedKeys);
+        }
+        mBuffer += record.binary;
+
+        if (mBuffer.size() >= mBufferSize || record.flush ||
+            std::chrono::steady_clock::now() - mLastFlush >= mFlushInterval)
+        {
+            flush();
+        }
+    }
+
+protected:
+    std::string fileHeader () const override
+    {
+        std::string header(binaryLogMagic);
+        appendBinary(header, binaryLogVersion);
+        for (int keyId = 0; keyId < mDefinedKeys; ++keyId)
+        {
+            appendKey(header, keyId);
+        }
+        return header;
+    }
+
+    // The key definitions in the buffer were lost along with it
+    // so every key gets defined again before it is used.
+    void bufferDropped () override
+    {
+        mDefinedKeys = 0;
+    }
+
+    static void appendKey (std::string & buffer, int keyId)
+    {
+        buffer += binaryKeyEntry;
+        appendBinary(buffer, static_cast<std::uint32_t>(keyId));
+        appendBinary(buffer, tagKeyName(keyId));
+    }
+
+    int mDefinedKeys;
+};
+
+// Everything in a binary record that comes before the tags.
+inline void appendBinaryRecordStart (std::string & buffer,
+    std::chrono::system_clock::time_point time,
+    std::size_t tagCount)
+{
+    buffer += binaryRecordEntry;
+    auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        time.time_since_epoch());
+    appendBinary(buffer, static_cast<std::int64_t>(ms.count()));
+    appendBinary(buffer, static_cast<std::uint16_t>(tagCount));
+}
+
+inline void encodeBinaryRecord (std::string & buffer,
+    std::chrono::system_clock::time_point time,
+    ActiveTags const & tags,
+    std::string_view message,
+    int & maxKeyId)
+{
+    appendBinaryRecordStart(buffer, time, tags.size());
+    appendTagBinary(buffer, tags, maxKeyId);
+    appendBinary(buffer, message);
+}
+
+// Reads the binary log format and turns each record back into
+// the same text line that a text output would have written.
+class BinaryLogReader
+{
+public:
+    BinaryLogReader (std::istream & input)
+    : mInput(input), mEnd(-1)
+    {
+        // The length is only known for streams that can seek.
+        auto const start = mInput.tellg();
+        if (start != -1 && mInput.seekg(0, std::ios::end))
+        {
+            mEnd = mInput.tellg();
+            mInput.seekg(start);
+        }
+        mInput.clear();
+    }
+
+    bool readHeader ()
+    {
+        char magic[sizeof(binaryLogMagic) - 1];
+        if (not mInput.read(magic, sizeof(magic)) ||
+            std::string_view(magic, sizeof(magic)) != binaryLogMagic)
+        {
+            return false;
+        }
+        std::uint8_t version;
+        return read(version) && version == binaryLogVersion;
+    }
+
+    // Returns false at the end of the log or when the
+    // data is not in the binary log format.
+    bool readLine (std::string & line)
+    {
+        char entry;
+        while (mInput.get(entry))
+        {
+            if (entry == binaryKeyEntry)
+            {
+                if (not readKey())
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (entry == binaryRecordEntry)
+            {
+                return readRecord(line);
+            }
+            return false;
+        }
+        return false;
+    }
+
+private:
+    template <typename T>
+    bool read (T & value)
+    {
+        using UnsignedT = std::make_unsigned_t<T>;
+        unsigned char bytes[sizeof(T)];
+        if (not mInput.read(reinterpret_cast<char *>(bytes), sizeof(T)))
+        {
+            return false;
+        }
+        UnsignedT bits = 0;
+        for (std::size_t i = sizeof(T); i > 0; --i)
+        {
+            bits = static_cast<UnsignedT>((bits << 8) | bytes[i - 1]);
+        }
+        value = static_cast<T>(bits);
+        return true;
+    }
+
+    // The size comes from the file which could be corrupt so it is
+    // checked against what is left before any memory is reserved.
+    // When the length is not known, the string only grows by a chunk
+    // at a time as the data arrives.
+    bool read (std::string & value)
+    {
+        std::uint32_t size;
+        if (not read(size) || size > remaining())
+        {
+            return false;
+        }
+        constexpr std::size_t chunkSize = 64 * 1024;
+        value.clear();
+        while (value.size() < size)
+        {
+            std::size_t const start = value.size();
+            std::size_t const count =
+                std::min<std::size_t>(size - start, chunkSize);
+            value.resize(start + count);
+            if (not mInput.read(value.data() + start, count))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::uint64_t remaining ()
+    {
+        if (mEnd == -1)
+        {
+            return std::numeric_limits<std::uint64_t>::max();
+        }
+        std::streamoff const pos = mInput.tellg();
+        if (pos == -1 || pos > mEnd)
+        {
+            return 0;
+        }
+        return static_cast<std::uint64_t>(mEnd - pos);
+    }
+
+    bool readKey ()
+    {
+        std::uint32_t keyId;
+        std::string name;
+        if (not read(keyId) || not read(name))
+        {
+            return false;
+        }
+        // Keys get defined in order so an id past the next one
+        // can only come from a corrupt file.
+        if (keyId > mKeyNames.size())
+        {
+            return false;
+        }
+        if (keyId == mKeyNames.size())
+        {
+            mKeyNames.resize(keyId + 1);
+        }
+        mKeyNames[keyId] = name;
+        return true;
+    }
+
+    bool readRecord (std::string & line)
+    {
+        std::int64_t ms;
+        std::uint16_t tagCount;
+        if (not read(ms) || not read(tagCount))
+        {
+            return false;
+        }
+        line.clear();
+        line += mTimestamp.format(std::chrono::system_clock::time_point(
+            std::chrono::milliseconds(ms)));
+        for (std::uint16_t i = 0; i < tagCount; ++i)
+        {
+            std::uint32_t keyId;
+            std::uint8_t type;
+            if (not read(keyId) || not read(type) ||
+                keyId >= mKeyNames.size())
+            {
+                return false;
+            }
+            line += ' ';
+            line += mKeyNames[keyId];
+            line += '=';
+            if (not readValue(static_cast<BinaryType>(type), line))
+            {
+                return false;
+            }
+        }
+        std::string message;
+        if (not read(message))
+        {
+            return false;
+        }
+        line += ' ';
+        line += message;
+        return true;
+    }
+
+    bool readValue (BinaryType type, std::string & line)
+    {
+        switch (type)
+        {
+        case BinaryType::String:
+        {
+            std::string value;
+            if (not read(value))
+            {
+                return false;
+            }
+            line += '"';
+            line += value;
+            line += '"';
+            return true;
+        }
+
+        case BinaryType::Int:
+        {
+            std::int32_t value;
+            if (not read(value))
+            {
+                return false;
+            }
+            line += std::to_string(value);
+            return true;
+        }
+
+        case BinaryType::LongLong:
+        {
+            std::int64_t value;
+            if (not read(value))
+            {
+                return false;
+            }
+            line += std::to_string(static_cast<long long>(value));
+            return true;
+        }
+
+        case BinaryType::Double:
+        {
+            std::uint64_t value;
+            if (not read(value))
+            {
+                return false;
+            }
+            line += std::to_string(std::bit_cast<double>(value));
+            return true;
+        }
+
+        case BinaryType::Bool:
+        {
+            std::uint8_t value;
+            if (not read(value))
+            {
+                return false;
+            }
+            line += value ? "true" : "false";
+            return true;
+        }
+        }
+        return false;
+    }
+
+    std::istream & mInput;
+    std::streamoff mEnd;
+    std::vector<std::string> mKeyNames;
+    TimestampCache mTimestamp;
+};
+
+inline bool decodeBinaryLog (std::istream & input, std::ostream & output)
+{
+    BinaryLogReader reader(input);
+    if (not reader.readHeader())
+    {
+        return false;
+    }
+    std::string line;
+    while (reader.readLine(line))
+    {
+        output << line << '\n';
+    }
+    return input.eof();
+}
+
+// A small compressor in the style of LZ4 for blocks of log text.
+// Each sequence is a token byte holding the number of literals in
+// the high four bits and the match length minus four in the low four
+// bits. Lengths of fifteen or more continue in extra bytes. The
+// literals and a two byte offset back to the match come next. The
+// last sequence only has literals.
+constexpr std::size_t lzMinMatch = 4;
+constexpr std::size_t lzMaxOffset = 65535;
+constexpr int lzHashBits = 12;
+
+inline void appendLzLength (std::string & output, std::size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        output += static_cast<char>(255);
+    }
+    output += static_cast<char>(length);
+}
+
+inline void appendLzSequence (std::string & output,
+    std::string_view literals,
+    std::size_t offset,
+    std::size_t matchLength)
+{
+    std::size_t const extra = matchLength - lzMinMatch;
+    output += static_cast<char>((std::min<std::size_t>(literals.size(), 15) << 4) |
+        std::min<std::size_t>(extra, 15));
+    if (literals.size() >= 15)
+    {
+        appendLzLength(output, literals.size() - 15);
+    }
+    output += literals;
+    output += static_cast<char>(offset & 0xff);
+    output += static_cast<char>(offset >> 8);
+    if (extra >= 15)
+    {
+        appendLzLength(output, extra - 15);
+    }
+}
+
+// The table is passed in so that its memory gets reused
+// from one block to the next.
+inline void compressLzBlock (std::string_view input,
+    std::string & output,
+    std::vector<std::uint32_t> & table)
+{
+    // Each entry holds a position plus one so that zero means empty.
+    table.assign(std::size_t(1) << lzHashBits, 0);
+    std::size_t anchor = 0;
+    std::size_t pos = 0;
+    while (pos + lzMinMatch <= input.size())
+    {
+        std::uint32_t sequence;
+        std::memcpy(&sequence, input.data() + pos, sizeof(sequence));
+        std::uint32_t const hash =
+            (sequence * 2654435761u) >> (32 - lzHashBits);
+        std::size_t const candidate = table[hash];
+        table[hash] = static_cast<std::uint32_t>(pos + 1);
+        if (candidate == 0 || pos - (candidate - 1) > lzMaxOffset ||
+            std::memcmp(input.data() + candidate - 1,
+                input.data() + pos, lzMinMatch) != 0)
+        {
+            ++pos;
+            continue;
+        }
+
+        std::size_t const match = candidate - 1;
+        std::size_t length = lzMinMatch;
+        while (pos + length < input.size() &&
+            input[match + length] == input[pos + length])
+        {
+            ++length;
+        }
+        appendLzSequence(output, input.substr(anchor, pos - anchor),
+            pos - match, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    std::size_t const remaining = input.size() - anchor;
+    output += static_cast<char>(std::min<std::size_t>(remaining, 15) << 4);
+    if (remaining >= 15)
+    {
+        appendLzLength(output, remaining - 15);
+    }
+    output += input.substr(anchor);
+}
+
+inline bool readLzLength (std::string_view input,
+    std::size_t & pos,
+    std::size_t & length)
+{
+    while (pos < input.size())
+    {
+        auto const byte = static_cast<unsigned char>(input[pos++]);
+        length += byte;
+        if (byte != 255)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false when the block is not valid or does not
+// decompress to exactly rawSize bytes.
+inline bool decompressLzBlock (std::string_view input,
+    std::string & output,
+    std::size_t rawSize)
+{
+    output.clear();
+    output.reserve(rawSize);
+    std::size_t pos = 0;
+    while (pos < input.size())
+    {
+        auto const token = static_cast<unsigned char>(input[pos++]);
+        std::size_t literals = token >> 4;
+        if (literals == 15 && not readLzLength(input, pos, literals))
+        {
+            return false;
+        }
+        if (literals > input.size() - pos ||
+            output.size() + literals > rawSize)
+        {
+            return false;
+        }
+        output.append(input.data() + pos, literals);
+        pos += literals;
+        if (pos == input.size())
+        {
+            break;
+        }
+
+        if (input.size() - pos < 2)
+        {
+            return false;
+        }
+        std::size_t const offset = static_cast<unsigned char>(input[pos]) |
+            (static_cast<std::size_t>(
+                static_cast<unsigned char>(input[pos + 1])) << 8);
+        pos += 2;
+        std::size_t length = token & 15;
+        if (length == 15 && not readLzLength(input, pos, length))
+        {
+            return false;
+        }
+        length += lzMinMatch;
+        if (offset == 0 || offset > output.size() ||
+            output.size() + length > rawSize)
+        {
+            return false;
+        }
+        // The match can overlap the bytes it produces
+        // so it is copied one byte at a time.
+        std::size_t const from = output.size() - offset;
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            char const ch = output[from + i];
+            output += ch;
+        }
+    }
+    return output.size() == rawSize;
+}
+
+constexpr char compressedLogMagic[] = "MMLZ";
+constexpr std::uint8_t compressedLogVersion = 2;
+constexpr char compressedIndexMagic[] = "MMLI";
+
+// The timestamp at the start of a line. Timestamps sort in time
+// order when compared as text.
+inline std::string_view lineTimestamp (std::string_view line)
+{
+    return line.substr(0, std::min<std::size_t>(line.find(' '), 64));
+}
+
+// Where a block is in a compressed log and the
+// timestamps of its first and last lines.
+struct CompressedBlock
+{
+    std::uint64_t offset;
+    std::uint32_t compressedSize;
+    std::uint32_t rawSize;
+    std::string first;
+    std::string last;
+};
+
+// A FileOutput that compresses each buffer full of lines into an
+// independent block. The compression happens when the buffer is
+// flushed, which is on the writer thread when logging is async.
+// Each block starts with its sizes and the timestamps of its first
+// and last lines.
+//
+// A finished file also ends with an index of its blocks so that
+// a reader can go straight to the blocks for a time window. The
+// index is itself stored as a block with a raw size of zero that
+// other readers skip, and the last bytes of the file point to it.
+// A file that is still being written, or that an earlier run left
+// and this one appended to, has no index that covers every block
+// and gets read one block header at a time instead.
+class CompressedFileOutput : public FileOutput
+{
+public:
+    CompressedFileOutput (std::string_view dir)
+    : FileOutput(dir), mIndexed(false)
+    {
+        mFileNamePattern = "application{}.mlz";
+    }
+
+    CompressedFileOutput (CompressedFileOutput const & rhs)
+    : FileOutput(rhs), mIndexed(false)
+    { }
+
+    ~CompressedFileOutput ()
+    {
+        // The last lines and the index need to be written before
+        // this output turns back into a plain FileOutput.
+        flush();
+        finishFile();
+    }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new CompressedFileOutput(*this));
+    }
+
+    // Every line goes through the buffer so that it ends up in
+    // a compressed block.
+    void sendLines (std::span<std::string_view const> lines) override
+    {
+        Output::sendLines(lines);
+    }
+
+protected:
+    std::string fileHeader () const override
+    {
+        std::string header(compressedLogMagic);
+        appendBinary(header, compressedLogVersion);
+        return header;
+    }
+
+    std::string fileTrailer () const override
+    {
+        if (not mIndexed || mBlocks.empty())
+        {
+            return {};
+        }
+        std::string entries;
+        appendBinary(entries, static_cast<std::uint32_t>(mBlocks.size()));
+        for (auto const & block: mBlocks)
+        {
+            appendBinary(entries, block.offset);
+            appendBinary(entries, block.compressedSize);
+            appendBinary(entries, block.rawSize);
+            appendTimestamp(entries, block.first);
+            appendTimestamp(entries, block.last);
+        }
+        entries += compressedIndexMagic;
+        appendBinary(entries, static_cast<std::uint64_t>(mFileSize));
+
+        std::string trailer;
+        appendBinary(trailer, static_cast<std::uint32_t>(entries.size()));
+        appendBinary(trailer, static_cast<std::uint32_t>(0));
+        appendTimestamp(trailer, mBlocks.front().first);
+        appendTimestamp(trailer, mBlocks.back().last);
+        trailer += entries;
+        return trailer;
+    }
+
+    void fileOpened (bool newFile) override
+    {
+        mBlocks.clear();
+        mIndexed = newFile;
+    }
+
+    void bufferWritten (std::uint64_t offset) override
+    {
+        // The offset of a block is where its compressed data starts.
+        mPending.offset = offset + mBlock.size() - mCompressed.size();
+        mBlocks.push_back(mPending);
+    }
+
+    std::string_view encodeBuffer (std::string_view buffer) override
+    {
+        std::string_view const first = lineTimestamp(buffer);
+        std::size_t const lastStart = buffer.size() > 1 ?
+            buffer.rfind('\n', buffer.size() - 2) : std::string_view::npos;
+        std::string_view const last = lineTimestamp(
+            lastStart == std::string_view::npos ?
+            buffer : buffer.substr(lastStart + 1));
+
+        mCompressed.clear();
+        compressLzBlock(buffer, mCompressed, mTable);
+
+        mPending.compressedSize =
+            static_cast<std::uint32_t>(mCompressed.size());
+        mPending.rawSize = static_cast<std::uint32_t>(buffer.size());
+        mPending.first = first;
+        mPending.last = last;
+
+        mBlock.clear();
+        appendBinary(mBlock, mPending.compressedSize);
+        appendBinary(mBlock, mPending.rawSize);
+        appendTimestamp(mBlock, first);
+        appendTimestamp(mBlock, last);
+        mBlock += mCompressed;
+        return mBlock;
+    }
+
+private:
+    static void appendTimestamp (std::string & buffer,
+        std::string_view timestamp)
+    {
+        appendBinary(buffer, static_cast<std::uint8_t>(timestamp.size()));
+        buffer += timestamp;
+    }
+
+    std::string mCompressed;
+    std::string mBlock;
+    std::vector<std::uint32_t> mTable;
+    CompressedBlock mPending;
+    std::vector<CompressedBlock> mBlocks;
+    bool mIndexed;
+};
+
+class CompressedLogReader
+{
+public:
+    CompressedLogReader (std::istream & input)
+    : mInput(input)
+    { }
+
+    // Version 1 logs are the same except that they never
+    // have an index.
+    bool readHeader ()
+    {
+        char magic[sizeof(compressedLogMagic) - 1];
+        char version;
+        return mInput.read(magic, sizeof(magic)) &&
+            std::string_view(magic, sizeof(magic)) == compressedLogMagic &&
+            mInput.get(version) &&
+            static_cast<std::uint8_t>(version) >= 1 &&
+            static_cast<std::uint8_t>(version) <= compressedLogVersion;
+    }
+
+    // Reads the index at the end of a finished log. Returns false
+    // and goes back to where it started when the log has no index.
+    bool readIndex (std::vector<CompressedBlock> & blocks)
+    {
+        std::streampos const start = mInput.tellg();
+        if (readIndexEntries(blocks))
+        {
+            return true;
+        }
+        blocks.clear();
+        mInput.clear();
+        mInput.seekg(start);
+        return false;
+    }
+
+    // Reads only the block headers and skips over the compressed
+    // data. Returns false at the end of the log.
+    bool readBlockHeader (CompressedBlock & block)
+    {
+        if (not read(block.compressedSize) || not read(block.rawSize) ||
+            not readTimestamp(block.first) || not readTimestamp(block.last))
+        {
+            return false;
+        }
+        block.offset = static_cast<std::uint64_t>(mInput.tellg());
+        return static_cast<bool>(mInput.seekg(block.compressedSize,
+            std::ios::cur));
+    }
+
+    bool readBlock (CompressedBlock const & block, std::string & text)
+    {
+        mCompressed.resize(block.compressedSize);
+        mInput.clear();
+        mInput.seekg(block.offset);
+        return mInput.read(mCompressed.data(), mCompressed.size()) &&
+            decompressLzBlock(mCompressed, text, block.rawSize);
+    }
+
+private:
+    template <typename T>
+    bool read (T & value)
+    {
+        unsigned char bytes[sizeof(T)];
+        if (not mInput.read(reinterpret_cast<char *>(bytes), sizeof(T)))
+        {
+            return false;
+        }
+        value = 0;
+        for (std::size_t i = sizeof(T); i > 0; --i)
+        {
+            value = static_cast<T>((value << 8) | bytes[i - 1]);
+        }
+        return true;
+    }
+
+    bool readTimestamp (std::string & timestamp)
+    {
+        std::uint8_t size;
+        if (not read(size))
+        {
+            return false;
+        }
+        timestamp.resize(size);
+        return static_cast<bool>(mInput.read(timestamp.data(), size));
+    }
+
+    bool readIndexEntries (std::vector<CompressedBlock> & blocks)
+    {
+        constexpr std::streamoff footerSize =
+            sizeof(compressedIndexMagic) - 1 + sizeof(std::uint64_t);
+        if (not mInput.seekg(0, std::ios::end))
+        {
+            return false;
+        }
+        std::streamoff const end = mInput.tellg();
+        char magic[sizeof(compressedIndexMagic) - 1];
+        std::uint64_t indexStart;
+        if (end < footerSize || not mInput.seekg(end - footerSize) ||
+            not mInput.read(magic, sizeof(magic)) ||
+            std::string_view(magic, sizeof(magic)) != compressedIndexMagic ||
+            not read(indexStart) ||
+            indexStart >= static_cast<std::uint64_t>(end))
+        {
+            return false;
+        }
+
+        // The index is stored as a block that ends with the footer.
+        // Each entry takes at least minEntrySize bytes which bounds
+        // the count before anything gets allocated for it.
+        constexpr std::uint32_t minEntrySize = 18;
+        CompressedBlock index;
+        std::uint32_t count;
+        if (not mInput.seekg(static_cast<std::streamoff>(indexStart)) ||
+            not readBlockHeader(index) || index.rawSize != 0 ||
+            index.offset + index.compressedSize !=
+            static_cast<std::uint64_t>(end) ||
+            not mInput.seekg(static_cast<std::streamoff>(index.offset)) ||
+            not read(count) || count > index.compressedSize / minEntrySize)
+        {
+            return false;
+        }
+        blocks.resize(count);
+        for (auto & block: blocks)
+        {
+            if (not read(block.offset) || not read(block.compressedSize) ||
+                not read(block.rawSize) || not readTimestamp(block.first) ||
+                not readTimestamp(block.last))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::istream & mInput;
+    std::string mCompressed;
+};
+
+// Writes the lines of a compressed log with timestamps from from up
+// to and including to. The to timestamp can be cut short so that
+// 2022-06-25T20 includes the whole hour. An empty from or to leaves
+// that end of the time window open. Only the blocks which overlap
+// the time window get decompressed.
+inline bool decompressLog (std::istream & input,
+    std::ostream & output,
+    std::string_view from = {},
+    std::string_view to = {})
+{
+    CompressedLogReader reader(input);
+    if (not reader.readHeader())
+    {
+        return false;
+    }
+    auto beforeWindow = [from] (CompressedBlock const & block)
+    {
+        return not from.empty() && block.last < from;
+    };
+    auto notAfterWindow = [to] (CompressedBlock const & block)
+    {
+        return to.empty() || block.first.substr(0, to.size()) <= to;
+    };
+    std::vector<CompressedBlock> blocks;
+    if (reader.readIndex(blocks))
+    {
+        // The blocks are written in time order so the ones
+        // in the window are found with binary searches.
+        auto const begin = std::partition_point(blocks.begin(),
+            blocks.end(), beforeWindow);
+        auto const end = std::partition_point(begin,
+            blocks.end(), notAfterWindow);
+        blocks.erase(end, blocks.end());
+        blocks.erase(blocks.begin(), begin);
+    }
+    else
+    {
+        CompressedBlock block;
+        while (reader.readBlockHeader(block))
+        {
+            // Blocks without lines hold an index.
+            if (block.rawSize > 0 && not beforeWindow(block) &&
+                notAfterWindow(block))
+            {
+                blocks.push_back(block);
+            }
+        }
+    }
+
+    std::string text;
+    for (auto const & selected: blocks)
+    {
+        if (not reader.readBlock(selected, text))
+        {
+            return false;
+        }
+        std::string_view lines = text;
+        while (not lines.empty())
+        {
+            std::size_t const end = lines.find('\n');
+            std::string_view const line = lines.substr(0, end);
+            lines.remove_prefix(end == std::string_view::npos ?
+                lines.size() : end + 1);
+            std::string_view const timestamp = lineTimestamp(line);
+            if ((from.empty() || timestamp >= from) &&
+                (to.empty() || timestamp.substr(0, to.size()) <= to))
+            {
+                output << line << '\n';
+            }
+        }
+    }
+    return true;
+}
+
+// Maps a whole log file into memory so that it can be searched
+// without copying it. The contents stay the same even if more
+// lines are written to the file after it is mapped.
+class MappedLogFile
+{
+public:
+    explicit MappedLogFile (std::string const & fileName)
+    {
+#if defined(_WIN32)
+        std::FILE * file = std::fopen(fileName.c_str(), "rb");
+        if (not file)
+        {
+            return;
+        }
+        char buffer[64 * 1024];
+        std::size_t count;
+        while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            mData.append(buffer, count);
+        }
+        std::fclose(file);
+        mOpen = true;
+#else
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0)
+        {
+            mSize = static_cast<std::size_t>(info.st_size);
+            mOpen = true;
+            if (mSize > 0)
+            {
+                void * address = ::mmap(nullptr, mSize, PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+                if (address == MAP_FAILED)
+                {
+                    mOpen = false;
+                    mSize = 0;
+                }
+                else
+                {
+                    mAddress = static_cast<char const *>(address);
+                    ::madvise(address, mSize, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    MappedLogFile (MappedLogFile const & rhs) = delete;
+    MappedLogFile & operator = (MappedLogFile const & rhs) = delete;
+
+    ~MappedLogFile ()
+    {
+#if not defined(_WIN32)
+        if (mAddress)
+        {
+            ::munmap(const_cast<char *>(mAddress), mSize);
+        }
+#endif
+    }
+
+    bool isOpen () const
+    {
+        return mOpen;
+    }
+
+    std::string_view contents () const
+    {
+#if defined(_WIN32)
+        return mData;
+#else
+        return std::string_view(mAddress, mSize);
+#endif
+    }
+
+private:
+    bool mOpen {false};
+#if defined(_WIN32)
+    std::string mData;
+#else
+    char const * mAddress {nullptr};
+    std::size_t mSize {0};
+#endif
+};
+
+// Ranks how often a byte shows up in log text with lower ranks
+// being less common. Spaces, digits and the punctuation of
+// timestamps and tags are on nearly every line.
+inline int logByteRank (char c)
+{
+    if (c == ' ')
+    {
+        return 4;
+    }
+    if ((c >= '0' && c <= '9') ||
+        std::string_view("\"=:-._etaoinsrlcdu").find(c) !=
+            std::string_view::npos)
+    {
+        return 3;
+    }
+    if (c >= 'a' && c <= 'z')
+    {
+        return 2;
+    }
+    return 1;
+}
+
+// Finds needle in text by looking for its least common byte with
+// memchr, which the C library runs with vector instructions, and
+// only comparing the whole needle where that byte is found. This
+// skips over far more of a log than searching for the first byte.
+inline std::size_t findLogText (std::string_view text,
+    std::string_view needle,
+    std::size_t pos = 0)
+{
+    std::size_t const length = needle.size();
+    if (length < 2 || pos >= text.size() || text.size() - pos < length)
+    {
+        return text.find(needle, pos);
+    }
+    std::size_t rare = 0;
+    for (std::size_t i = 1; i < length; ++i)
+    {
+        if (logByteRank(needle[i]) < logByteRank(needle[rare]))
+        {
+            rare = i;
+        }
+    }
+    char const * const data = text.data();
+    char const * const last = data + text.size() - (length - 1 - rare);
+    char const * found = data + pos + rare;
+    while (found < last)
+    {
+        found = static_cast<char const *>(
+            std::memchr(found, needle[rare], last - found));
+        if (not found)
+        {
+            break;
+        }
+        char const * const start = found - rare;
+        if (std::memcmp(start, needle.data(), length) == 0)
+        {
+            return start - data;
+        }
+        ++found;
+    }
+    return std::string_view::npos;
+}
+
+// Reads a tag value written in a text log. Quoted values are
+// strings. Other values are bools, whole numbers, or decimal
+// numbers when they can be read as one and strings otherwise.
+// Whole numbers are read as long long no matter which tag type
+// wrote them so that they can be compared with each other.
+inline TagValue parseLogTagValue (std::string_view text)
+{
+    if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+    {
+        return text.substr(1, text.size() - 2);
+    }
+    if (text == "true" || text == "false")
+    {
+        return text == "true";
+    }
+    char const * const end = text.data() + text.size();
+    long long whole;
+    auto [wholeEnd, wholeError] = std::from_chars(text.data(), end, whole);
+    if (wholeError == std::errc() && wholeEnd == end)
+    {
+        return whole;
+    }
+    double decimal;
+    auto [decimalEnd, decimalError] =
+        std::from_chars(text.data(), end, decimal);
+    if (decimalError == std::errc() && decimalEnd == end)
+    {
+        return decimal;
+    }
+    return text;
+}
+
+// Selects lines with a tag that compares to the value the same way
+// that a filter literal does. The value is kept as text and read
+// with parseLogTagValue.
+struct LogTagPredicate
+{
+    std::string key;
+    TagOperation operation {TagOperation::Equal};
+    std::string value;
+};
+
+// Reads a predicate such as count>=5, color=red or name="a b".
+inline LogTagPredicate parseLogTagPredicate (std::string_view text)
+{
+    std::size_t const pos = text.find_first_of("<>=");
+    if (pos == 0 || pos == std::string_view::npos)
+    {
+        throw std::invalid_argument("Tag predicate needs a key and "
+            "one of =, <, <=, > or >=.");
+    }
+    LogTagPredicate predicate;
+    predicate.key = text.substr(0, pos);
+    std::size_t valuePos = pos + 1;
+    bool const orEqual = valuePos < text.size() && text[valuePos] == '=';
+    switch (text[pos])
+    {
+    case '<':
+        predicate.operation = orEqual ?
+            TagOperation::LessThanOrEqual : TagOperation::LessThan;
+        break;
+
+    case '>':
+        predicate.operation = orEqual ?
+            TagOperation::GreaterThanOrEqual : TagOperation::GreaterThan;
+        break;
+
+    default:
+        predicate.operation = TagOperation::Equal;
+        break;
+    }
+    if (orEqual)
+    {
+        ++valuePos;
+    }
+    predicate.value = text.substr(valuePos);
+    return predicate;
+}
+
+// Makes a predicate from a tag such as Count(5, TagOperation::LessThan).
+// A tag without an operation selects lines with an equal value.
+inline LogTagPredicate makeLogTagPredicate (Tag const & tag)
+{
+    LogTagPredicate predicate;
+    predicate.key = tag.key();
+    if (tag.operation() != TagOperation::None)
+    {
+        predicate.operation = tag.operation();
+    }
+    predicate.value = tag.text().substr(tag.key().size() + 1);
+    return predicate;
+}
+
+// Describes the lines to find in a text log. Every condition that
+// is given needs to match. The times are compared with the start of
+// each line in the same way as decompressLog so to includes every
+// time that starts with it. Lines are expected to be in time order
+// as they are written by FileOutput.
+struct LogQuery
+{
+    std::string from;
+    std::string to;
+    std::vector<std::string> text;
+    std::vector<LogTagPredicate> tags;
+
+    // Zero means no limit.
+    std::size_t maxLines {0};
+
+    // Zero picks one thread for each core as long as each
+    // thread gets at least minChunkSize bytes to search.
+    unsigned int threads {0};
+    std::size_t minChunkSize {1024 * 1024};
+};
+
+// Returns the offset of the first line at or after begin for which
+// stop returns true. The lines are checked with a binary search.
+template <typename StopT>
+std::size_t findLogLine (std::string_view contents,
+    std::size_t begin,
+    StopT stop)
+{
+    std::size_t low = begin;
+    std::size_t high = contents.size();
+    // Both low and high are line starts. The lines before low do
+    // not stop and neither does the line at low unless low is begin.
+    while (low < high)
+    {
+        std::size_t const end = contents.find('\n', low + (high - low) / 2);
+        if (end == std::string_view::npos || end + 1 >= high)
+        {
+            break;
+        }
+        if (stop(lineTimestamp(contents.substr(end + 1))))
+        {
+            high = end + 1;
+        }
+        else
+        {
+            low = end + 1;
+        }
+    }
+    // Only a line or two are left to check.
+    while (low < high)
+    {
+        if (stop(lineTimestamp(contents.substr(low))))
+        {
+            return low;
+        }
+        std::size_t const end = contents.find('\n', low);
+        if (end == std::string_view::npos)
+        {
+            return high;
+        }
+        low = end + 1;
+    }
+    return high;
+}
+
+// The query with each tag value read once and the longest text
+// that every matching line has to contain picked as the anchor
+// which is searched for first.
+class CompiledLogQuery
+{
+public:
+    explicit CompiledLogQuery (LogQuery const & query)
+    : mQuery(query)
+    {
+        for (auto const & text: query.text)
+        {
+            if (text.size() > mAnchor.size())
+            {
+                mAnchor = text;
+            }
+        }
+        for (auto const & predicate: query.tags)
+        {
+            mTags.push_back({" " + predicate.key + "=",
+                predicate.operation,
+                parseLogTagValue(predicate.value),
+                {}});
+            CompiledTag & tag = mTags.back();
+            tag.exact = tag.needle;
+            if (tag.operation == TagOperation::Equal &&
+                not appendExactValue(tag.exact, tag.value))
+            {
+                tag.exact.clear();
+            }
+        }
+        // Equal tags have to be written exactly as their text.
+        for (auto const & tag: mTags)
+        {
+            std::string_view const text = tag.exact.empty() ?
+                std::string_view(tag.needle) : tag.exact;
+            if (text.size() > mAnchor.size())
+            {
+                mAnchor = text;
+            }
+        }
+    }
+
+    CompiledLogQuery (CompiledLogQuery const & rhs) = delete;
+
+    std::string_view anchor () const
+    {
+        return mAnchor;
+    }
+
+    bool matches (std::string_view line) const
+    {
+        for (auto const & text: mQuery.text)
+        {
+            if (findLogText(line, text) == std::string_view::npos)
+            {
+                return false;
+            }
+        }
+        for (auto const & tag: mTags)
+        {
+            std::string_view const key = std::string_view(tag.needle)
+                .substr(1, tag.needle.size() - 2);
+            std::string_view value;
+            if (not findTagValue(line, key, value) ||
+                not matchTagValues(TagOperation::None,
+                    parseLogTagValue(value), tag.operation, tag.value))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct CompiledTag
+    {
+        std::string needle;
+        TagOperation operation;
+        TagValue value;
+        std::string exact;
+    };
+
+    // Adds the value the way a tag writes it. Decimal values can be
+    // written more than one way so they are left out.
+    static bool appendExactValue (std::string & text, TagValue const & value)
+    {
+        if (auto const * typed = std::get_if<std::string_view>(&value))
+        {
+            text += '"';
+            text += *typed;
+            text += '"';
+        }
+        else if (auto const * typed = std::get_if<long long>(&value))
+        {
+            text += std::to_string(*typed);
+        }
+        else if (auto const * typed = std::get_if<bool>(&value))
+        {
+            text += *typed ? "true" : "false";
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // A quoted value ends with a quote followed by a space.
+    static std::string_view tagValueText (std::string_view line,
+        std::size_t pos)
+    {
+        std::string_view const rest = line.substr(pos);
+        if (not rest.empty() && rest.front() == '"')
+        {
+            std::size_t const end = rest.find("\" ", 1);
+            return end == std::string_view::npos ? rest :
+                rest.substr(0, end + 1);
+        }
+        return rest.substr(0, rest.find(' '));
+    }
+
+    // Looks for the key only in the tags between the timestamp and
+    // the message. The tags end at the first word which is not a key
+    // followed by an equal sign so that the same text in the message
+    // or inside a quoted value is never taken for the tag.
+    static bool findTagValue (std::string_view line,
+        std::string_view key,
+        std::string_view & value)
+    {
+        std::size_t pos = line.find(' ');
+        while (pos != std::string_view::npos && pos + 1 < line.size())
+        {
+            std::size_t const start = pos + 1;
+            std::size_t const equal = line.find_first_of("= ", start);
+            if (equal == std::string_view::npos || equal == start ||
+                line[equal] != '=')
+            {
+                return false;
+            }
+            std::string_view const text = tagValueText(line, equal + 1);
+            if (line.substr(start, equal - start) == key)
+            {
+                value = text;
+                return true;
+            }
+            pos = equal + 1 + text.size();
+            if (pos >= line.size() || line[pos] != ' ')
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    LogQuery const & mQuery;
+    std::string_view mAnchor;
+    std::vector<CompiledTag> mTags;
+};
+
+// Adds the matching lines between begin and end which are line
+// starts. When there is an anchor, only the lines that contain it
+// get looked at.
+inline void scanLogChunk (std::string_view contents,
+    std::size_t begin,
+    std::size_t end,
+    CompiledLogQuery const & query,
+    std::size_t maxLines,
+    std::vector<std::string_view> & lines)
+{
+    std::string_view const chunk = contents.substr(0, end);
+    std::size_t pos = begin;
+    while (pos < end && (maxLines == 0 || lines.size() < maxLines))
+    {
+        std::size_t lineStart = pos;
+        if (not query.anchor().empty())
+        {
+            std::size_t const hit = findLogText(chunk, query.anchor(), pos);
+            if (hit == std::string_view::npos)
+            {
+                return;
+            }
+            std::size_t const previous = chunk.rfind('\n', hit);
+            if (previous != std::string_view::npos && previous >= pos)
+            {
+                lineStart = previous + 1;
+            }
+        }
+        std::size_t lineEnd = chunk.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
+        {
+            lineEnd = end;
+        }
+        std::string_view const line =
+            chunk.substr(lineStart, lineEnd - lineStart);
+        if (query.matches(line))
+        {
+            lines.push_back(line);
+        }
+        pos = lineEnd + 1;
+    }
+}
+
+// Returns the lines of a text log that match the query in the
+// order they appear. The lines refer to contents. Large logs are
+// split into chunks at line boundaries which are searched by
+// separate threads.
+inline std::vector<std::string_view> queryLog (std::string_view contents,
+    LogQuery const & query)
+{
+    std::size_t begin = 0;
+    if (not query.from.empty())
+    {
+        begin = findLogLine(contents, 0,
+            [&query] (std::string_view timestamp)
+        {
+            return timestamp >= query.from;
+        });
+    }
+    std::size_t end = contents.size();
+    if (not query.to.empty())
+    {
+        end = findLogLine(contents, begin,
+            [&query] (std::string_view timestamp)
+        {
+            return timestamp.substr(0, query.to.size()) > query.to;
+        });
+    }
+
+    std::size_t threads = query.threads;
+    if (threads == 0)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = std::min(threads,
+            (end - begin) / std::max<std::size_t>(query.minChunkSize, 1));
+        threads = std::max<std::size_t>(threads, 1);
+    }
+
+    CompiledLogQuery const compiled(query);
+    std::vector<std::size_t> starts {begin};
+    for (std::size_t i = 1; i < threads; ++i)
+    {
+        std::size_t pos = begin + (end - begin) * i / threads;
+        pos = contents.find('\n', std::max(pos, starts.back()));
+        if (pos == std::string_view::npos || pos + 1 >= end)
+        {
+            break;
+        }
+        starts.push_back(pos + 1);
+    }
+    starts.push_back(end);
+
+    std::vector<std::vector<std::string_view>> found(starts.size() - 1);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < found.size(); ++i)
+    {
+        workers.emplace_back([&, i] ()
+        {
+            scanLogChunk(contents, starts[i], starts[i + 1],
+                compiled, query.maxLines, found[i]);
+        });
+    }
+    scanLogChunk(contents, starts[0], starts[1],
+        compiled, query.maxLines, found[0]);
+    for (auto & worker: workers)
+    {
+        worker.join();
+    }
+
+    std::vector<std::string_view> lines = std::move(found[0]);
+    for (std::size_t i = 1; i < found.size(); ++i)
+    {
+        lines.insert(lines.end(), found[i].begin(), found[i].end());
+    }
+    if (query.maxLines != 0 && lines.size() > query.maxLines)
+    {
+        lines.resize(query.maxLines);
+    }
+    return lines;
+}
+
+// Collects the message into memory that is kept between records.
+class MessageBuffer : public std::streambuf
+{
+public:
+    std::string_view view () const
+    {
+        return std::string_view(pbase(), pptr() - pbase());
+    }
+
+    void reset (std::size_t maxKeptSize)
+    {
+        if (mData.size() > maxKeptSize)
+        {
+            std::string().swap(mData);
+        }
+        setp(mData.data(), mData.data() + mData.size());
+    }
+
+protected:
+    int_type overflow (int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            return traits_type::not_eof(ch);
+        }
+        grow(1);
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
+    }
+
+    std::streamsize xsputn (char const * s, std::streamsize count) override
+    {
+        if (epptr() - pptr() < count)
+        {
+            grow(static_cast<std::size_t>(count));
+        }
+        traits_type::copy(pptr(), s, static_cast<std::size_t>(count));
+        pbump(static_cast<int>(count));
+        return count;
+    }
+
+private:
+    void grow (std::size_t needed)
+    {
+        std::size_t used = pptr() - pbase();
+        mData.resize(std::max({mData.size() * 2, used + needed,
+            std::size_t(256)}));
+        setp(mData.data(), mData.data() + mData.size());
+        pbump(static_cast<int>(used));
+    }
+
+    std::string mData;
+};
+
+// Everything needed to format one record. Each thread keeps the
+// arenas it has used so that the stream and the memory for the
+// message, text line and binary encoding get reused. Only a record
+// larger than maxKeptSize gives its memory back to the heap.
+class RecordArena
+{
+public:
+    static constexpr std::size_t maxKeptSize = 64 * 1024;
+
+    RecordArena ()
+    : mStream(nullptr)
+    {
+        mStream.rdbuf(&mBuffer);
+        reset();
+    }
+
+    RecordArena (RecordArena const & other) = delete;
+    RecordArena & operator = (RecordArena const & rhs) = delete;
+
+    std::ostream & stream ()
+    {
+        return mStream;
+    }
+
+    std::string_view message () const
+    {
+        return mBuffer.view();
+    }
+
+    std::string & line ()
+    {
+        return mLine;
+    }
+
+    std::string & binary ()
+    {
+        return mBinary;
+    }
+
+    std::string & tagText ()
+    {
+        return mTagText;
+    }
+
+    void reset ()
+    {
+        mBuffer.reset(maxKeptSize);
+        resetString(mLine);
+        resetString(mBinary);
+        resetString(mTagText);
+
+        // Undo anything a manipulator may have changed.
+        mStream.clear();
+        mStream.flags(std::ios_base::skipws | std::ios_base::dec);
+        mStream.precision(6);
+        mStream.width(0);
+        mStream.fill(' ');
+    }
+
+private:
+    static void resetString (std::string & text)
+    {
+        if (text.capacity() > maxKeptSize)
+        {
+            std::string().swap(text);
+        }
+        text.clear();
+    }
+
+    MessageBuffer mBuffer;
+    std::ostream mStream;
+    std::string mLine;
+    std::string mBinary;
+    std::string mTagText;
+};
+
+// A record that passed the filter and is waiting for its message.
+// The configuration keeps the default tags and the outputs alive
+// until the record has been written.
+struct PendingRecord
+{
+    RecordArena arena;
+    ActiveTags tags;
+    std::shared_ptr<LogConfig const> config;
+    std::chrono::system_clock::time_point time;
+    bool flush {false};
+};
+
+inline std::vector<std::unique_ptr<PendingRecord>> & getFreePendingRecords ()
+{
+    thread_local std::vector<std::unique_ptr<PendingRecord>> records;
+    return records;
+}
+
+inline std::unique_ptr<PendingRecord> acquirePendingRecord ()
+{
+    auto & records = getFreePendingRecords();
+    if (records.empty())
+    {
+        return std::make_unique<PendingRecord>();
+    }
+    auto record = std::move(records.back());
+    records.pop_back();
+    return record;
+}
+
+inline void releasePendingRecord (std::unique_ptr<PendingRecord> record)
+{
+    record->arena.reset();
+    record->tags.clear();
+    record->config.reset();
+    record->flush = false;
+    getFreePendingRecords().push_back(std::move(record));
+}
+
+inline void sendRecordToOutputs (LogRecord const & record,
+    std::vector<std::shared_ptr<Output>> const & outputs)
+{
+    for (auto const & output: outputs)
+    {
+        OutputLock lock(*output);
+        OutputStats & stats = output->stats();
+        bool const timed = stats.timeNextSend();
+        std::chrono::steady_clock::time_point start;
+        if (timed)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+        output->sendRecord(record);
+        if (record.flush)
+        {
+            output->flush();
+        }
+        if (timed)
+        {
+            stats.recordLatency(std::chrono::steady_clock::now() - start);
+        }
+        stats.recordSend(1, output->format() == OutputFormat::Text ?
+            record.line.size() + 1 : record.binary.size());
+    }
+}
+
+// Writes the message of a deferred record from the arguments
+// that were captured by the caller.
+using DeferredFormatter = void (*) (std::ostream & stream,
+    std::string_view format,
+    std::string_view arguments);
+
+// A record waiting in the async queue. Most records arrive already
+// formatted. A deferred record instead holds the raw parts captured
+// by the caller and the writer thread formats it.
+struct QueuedRecord
+{
+    std::string line;
+    std::string binary;
+    int maxKeyId {-1};
+    bool flush {false};
+
+    DeferredFormatter formatter {nullptr};
+    std::string_view format;
+    std::chrono::system_clock::time_point time;
+    bool needText {false};
+    bool needBinary {false};
+    std::string tagText;
+    std::string tagBinary;
+    std::size_t tagCount {0};
+    std::string arguments;
+
+    // The record goes to the outputs of the config that selected it
+    // even when the outputs change while it waits in the queue.
+    std::shared_ptr<LogConfig const> config;
+};
+
+inline void formatDeferredRecord (QueuedRecord & record,
+    RecordArena & arena)
+{
+    arena.reset();
+    record.formatter(arena.stream(), record.format, record.arguments);
+    std::string_view message = arena.message();
+
+    record.line.clear();
+    if (record.needText)
+    {
+        record.line += getTimestampCache().format(record.time);
+        record.line += record.tagText;
+        record.line += ' ';
+        record.line += message;
+    }
+    record.binary.clear();
+    if (record.needBinary)
+    {
+        appendBinaryRecordStart(record.binary, record.time,
+            record.tagCount);
+        record.binary += record.tagBinary;
+        appendBinary(record.binary, message);
+    }
+}
+
+// Sends a batch of records while holding each output's lock just
+// once. Text outputs get all of the lines in a single call.
+inline void sendRecordsToOutputs (std::span<LogRecord const> records,
+    std::span<std::string_view const> lines,
+    std::vector<std::shared_ptr<Output>> const & outputs)
+{
+    bool flush = false;
+    std::size_t textBytes = 0;
+    std::size_t binaryBytes = 0;
+    for (auto const & record: records)
+    {
+        flush = flush || record.flush;
+        textBytes += record.line.size() + 1;
+        binaryBytes += record.binary.size();
+    }
+    for (auto const & output: outputs)
+    {
+        OutputLock lock(*output);
+        OutputStats & stats = output->stats();
+        bool const timed = stats.timeNextSend();
+        std::chrono::steady_clock::time_point start;
+        if (timed)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+        bool const text = output->format() == OutputFormat::Text;
+        if (text)
+        {
+            output->sendLines(lines);
+        }
+        else
+        {
+            for (auto const & record: records)
+            {
+                output->sendRecord(record);
+            }
+        }
+        if (flush)
+        {
+            output->flush();
+        }
+        if (timed)
+        {
+            stats.recordLatency(std::chrono::steady_clock::now() - start);
+        }
+        stats.recordSend(records.size(), text ? textBytes : binaryBytes);
+    }
+}
+
+// Counts what happens to the records of one thread. Only the
+// thread itself changes its counters so there is no contention.
+// The counters of all threads are added up when they are read.
+struct ThreadLogCounters
+{
+    std::atomic<unsigned long long> emitted {0};
+    std::atomic<unsigned long long> filteredOut {0};
+    std::atomic<unsigned long long> limited {0};
+
+    static void add (std::atomic<unsigned long long> & counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+};
+
+class LogCounterRegistry
+{
+public:
+    void add (ThreadLogCounters const * counters)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreads.push_back(counters);
+    }
+
+    // The counts of a thread that ends are kept.
+    void remove (ThreadLogCounters const * counters)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEmitted += counters->emitted.load(std::memory_order_relaxed);
+        mFilteredOut += counters->filteredOut.load(std::memory_order_relaxed);
+        mLimited += counters->limited.load(std::memory_order_relaxed);
+        std::erase(mThreads, counters);
+    }
+
+    void totals (unsigned long long & emitted,
+        unsigned long long & filteredOut,
+        unsigned long long & limited)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        emitted = mEmitted;
+        filteredOut = mFilteredOut;
+        limited = mLimited;
+        for (auto const & counters: mThreads)
+        {
+            emitted += counters->emitted.load(std::memory_order_relaxed);
+            filteredOut +=
+                counters->filteredOut.load(std::memory_order_relaxed);
+            limited += counters->limited.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::mutex mMutex;
+    std::vector<ThreadLogCounters const *> mThreads;
+    unsigned long long mEmitted {0};
+    unsigned long long mFilteredOut {0};
+    unsigned long long mLimited {0};
+};
+
+inline LogCounterRegistry & getLogCounterRegistry ()
+{
+    static LogCounterRegistry registry;
+    return registry;
+}
+
+inline ThreadLogCounters & threadLogCounters ()
+{
+    struct Registration
+    {
+        Registration ()
+        {
+            getLogCounterRegistry().add(&counters);
+        }
+
+        ~Registration ()
+        {
+            getLogCounterRegistry().remove(&counters);
+        }
+
+        ThreadLogCounters counters;
+    };
+    thread_local Registration registration;
+    return registration.counters;
+}
+
+enum class QueueFullPolicy
+{
+    Block,
+    Drop,
+    Synchronous
+};
+
+class AsyncWriter
+{
+public:
+    AsyncWriter ()
+    : mRunning(false), mDeferFormatting(false), mStopping(false),
+    mPolicy(QueueFullPolicy::Block), mHead(0), mCount(0), mMaxCount(0),
+    mDropped(0)
+    {
+        // The outputs must outlive the writer thread so make sure
+        // they are constructed first and therefore destroyed last.
+        getLogConfig();
+    }
+
+    AsyncWriter (AsyncWriter const & other) = delete;
+    AsyncWriter (AsyncWriter && other) = delete;
+
+    ~AsyncWriter ()
+    {
+        stop();
+    }
+
+    AsyncWriter & operator = (AsyncWriter const & rhs) = delete;
+    AsyncWriter & operator = (AsyncWriter && rhs) = delete;
+
+    void start (std::size_t capacity, QueueFullPolicy policy,
+        bool deferFormatting)
+    {
+        stop();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.clear();
+        mQueue.resize(std::max<std::size_t>(capacity, 1));
+        mHead = 0;
+        mCount = 0;
+        mPolicy = policy;
+        mDeferFormatting = deferFormatting;
+        mStopping = false;
+        mThread = std::thread(&AsyncWriter::run, this);
+        mRunning = true;
+    }
+
+    void stop ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (not mThread.joinable())
+            {
+                return;
+            }
+            mRunning = false;
+            mStopping = true;
+        }
+        mNotEmpty.notify_one();
+        mNotFull.notify_all();
+        mThread.join();
+    }
+
+    bool running () const
+    {
+        return mRunning;
+    }
+
+    bool defersFormatting () const
+    {
+        return mDeferFormatting;
+    }
+
+    unsigned long long droppedCount () const
+    {
+        return mDropped;
+    }
+
+    std::size_t queueDepth ()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mCount;
+    }
+
+    std::size_t maxQueueDepth () const
+    {
+        return mMaxCount.load(std::memory_order_relaxed);
+    }
+
+    bool push (LogRecord const & record,
+        std::shared_ptr<LogConfig const> const & config)
+    {
+        // Assigning to the slot reuses the memory it already has.
+        return pushWith([&record, &config] (QueuedRecord & slot)
+        {
+            slot.line.assign(record.line);
+            slot.binary.assign(record.binary);
+            slot.maxKeyId = record.maxKeyId;
+            slot.flush = record.flush;
+            slot.formatter = nullptr;
+            slot.config = config;
+        });
+    }
+
+    // Calls fill with the next free slot in the queue. Returns false
+    // when the record was not queued and the caller needs to send it
+    // to the outputs itself.
+    template <typename FillT>
+    bool pushWith (FillT fill)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mStopping)
+        {
+            return false;
+        }
+        if (mCount == mQueue.size())
+        {
+            switch (mPolicy)
+            {
+            case QueueFullPolicy::Block:
+                mNotFull.wait(lock, [this]
+                {
+                    return mStopping || mCount < mQueue.size();
+                });
+                if (mStopping)
+                {
+                    return false;
+                }
+                break;
+
+            case QueueFullPolicy::Drop:
+                ++mDropped;
+                return true;
+
+            case QueueFullPolicy::Synchronous:
+                return false;
+            }
+        }
+        fill(mQueue[(mHead + mCount) % mQueue.size()]);
+        ++mCount;
+        if (mCount > mMaxCount.load(std::memory_order_relaxed))
+        {
+            mMaxCount.store(mCount, std::memory_order_relaxed);
+        }
+        lock.unlock();
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+private:
+    void run ()
+    {
+        // Deferred records get formatted into this arena.
+        RecordArena arena;
+
+        // The batch and the queue swap records so that the memory
+        // held by each record keeps getting reused.
+        std::vector<QueuedRecord> batch;
+        std::size_t batchSize = 0;
+        std::vector<LogRecord> records;
+        std::vector<std::string_view> lines;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mNotEmpty.wait(lock, [this]
+                {
+                    return mStopping || mCount > 0;
+                });
+                if (mCount == 0)
+                {
+                    // We only get here when stopping with
+                    // nothing left to write.
+                    return;
+                }
+                batchSize = 0;
+                while (mCount > 0)
+                {
+                    if (batchSize == batch.size())
+                    {
+                        batch.emplace_back();
+                    }
+                    std::swap(batch[batchSize], mQueue[mHead]);
+                    ++batchSize;
+                    mHead = (mHead + 1) % mQueue.size();
+                    --mCount;
+                }
+            }
+            mNotFull.notify_all();
+
+            records.clear();
+            lines.clear();
+            for (std::size_t i = 0; i < batchSize; ++i)
+            {
+                if (batch[i].formatter)
+                {
+                    formatDeferredRecord(batch[i], arena);
+                }
+                records.push_back({batch[i].line, batch[i].binary,
+                    batch[i].maxKeyId, batch[i].flush});
+                lines.push_back(batch[i].line);
+            }
+            sendBatch(records, lines, batch, batchSize);
+        }
+    }
+
+    // Records in a row that were logged with the same outputs
+    // get sent together.
+    static void sendBatch (std::span<LogRecord const> records,
+        std::span<std::string_view const> lines,
+        std::vector<QueuedRecord> & batch,
+        std::size_t batchSize)
+    {
+        auto const & current = currentLogConfig();
+        std::size_t first = 0;
+        for (std::size_t i = 1; i <= batchSize; ++i)
+        {
+            auto const & config = batch[first].config;
+            if (i < batchSize && (batch[i].config == config ||
+                batch[i].config->outputs == config->outputs))
+            {
+                continue;
+            }
+            sendRecordsToOutputs(records.subspan(first, i - first),
+                lines.subspan(first, i - first), config->outputs);
+            if (config->outputs != current->outputs)
+            {
+                // Nothing else writes what the outputs
+                // that were swapped out still hold.
+                flushOutputs(config->outputs);
+            }
+            first = i;
+        }
+        for (std::size_t i = 0; i < batchSize; ++i)
+        {
+            batch[i].config.reset();
+        }
+    }
+
+    std::atomic<bool> mRunning;
+    std::atomic<bool> mDeferFormatting;
+    bool mStopping;
+    QueueFullPolicy mPolicy;
+    std::vector<QueuedRecord> mQueue;
+    std::size_t mHead;
+    std::size_t mCount;
+    std::atomic<std::size_t> mMaxCount;
+    std::atomic<unsigned long long> mDropped;
+    std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::thread mThread;
+};
+
+inline AsyncWriter & getAsyncWriter ()
+{
+    static AsyncWriter writer;
+    return writer;
+}
+
+// When deferFormatting is true, messages logged with logf only have
+// their arguments copied by the caller. The writer thread formats
+// the timestamp and the message.
+inline void enableAsyncLogging (std::size_t capacity = 8192,
+    QueueFullPolicy policy = QueueFullPolicy::Block,
+    bool deferFormatting = false)
+{
+    getAsyncWriter().start(capacity, policy, deferFormatting);
+}
+
+inline void disableAsyncLogging ()
+{
+    // Any records still in the queue are written before this returns.
+    getAsyncWriter().stop();
+}
+
+inline unsigned long long droppedLogCount ()
+{
+    return getAsyncWriter().droppedCount();
+}
+
+struct OutputStatsSnapshot
+{
+    std::string name;
+    unsigned long long lines;
+    unsigned long long bytes;
+    unsigned long long contendedLocks;
+    std::chrono::nanoseconds lockWait;
+    std::array<unsigned long long, OutputStats::latencyBuckets> latency;
+    unsigned long long droppedBytes;
+};
+
+struct LogStats
+{
+    unsigned long long emitted;
+    unsigned long long filteredOut;
+    unsigned long long limited;
+    unsigned long long dropped;
+    std::size_t queueDepth;
+    std::size_t maxQueueDepth;
+    std::vector<OutputStatsSnapshot> outputs;
+};
+
+// Reads all of the logging counters. The counters keep changing
+// while they are read so the numbers can be a little apart.
+inline LogStats stats ()
+{
+    LogStats result {};
+    getLogCounterRegistry().totals(result.emitted, result.filteredOut,
+        result.limited);
+    auto & writer = getAsyncWriter();
+    result.dropped = writer.droppedCount();
+    result.queueDepth = writer.queueDepth();
+    result.maxQueueDepth = writer.maxQueueDepth();
+    for (auto const & output: currentLogConfig()->outputs)
     {
-        return std::unique_ptr<Output>(
-            new StreamOutput(*this));
+        OutputStats const & counters = output->stats();
+        result.outputs.push_back({output->name(), counters.lines(),
+            counters.bytes(), counters.contendedLocks(),
+            counters.lockWait(), counters.latency(),
+            counters.droppedBytes()});
     }
+    return result;
+}
 
-    void sendLine (std::string const & line) override
+// Only the formats that the outputs need are built.
+inline void neededFormats (LogConfig const & config,
+    bool & needText,
+    bool & needBinary)
+{
+    for (auto const & output: config.outputs)
     {
-        mStream << line << std::endl;
+        if (output->format() == OutputFormat::Binary)
+        {
+            needBinary = true;
+        }
+        else
+        {
+            needText = true;
+        }
     }
+}
 
-protected:
-    std::ostream & mStream;
-};
+inline void formatLine (std::string & line,
+    std::chrono::system_clock::time_point time,
+    ActiveTags const & tags,
+    std::string_view message)
+{
+    line += getTimestampCache().format(time);
+    appendTagText(line, tags);
+    line += ' ';
+    line += message;
+}
 
-class LogStream : public std::stringstream
+// A LogStream for a record that was filtered out holds nothing
+// and everything streamed into it is skipped after a single check.
+class LogStream
 {
 public:
     LogStream ()
-    : mProceed(true)
+    { }
+
+    explicit LogStream (std::unique_ptr<PendingRecord> record)
+    : mRecord(std::move(record))
     { }
 
     LogStream (LogStream const & other) = delete;
 
     LogStream (LogStream && other)
-    : std::stringstream(std::move(other)),
-    mProceed(other.mProceed)
+    : mRecord(std::move(other.mRecord))
     { }
 
     ~LogStream ()
     {
-        if (not mProceed)
-        {
-            return;
-        }
-
-        const std::lock_guard<std::mutex> lock(getLoggingMutex());
-
-        auto & outputs = getOutputs();
-        for (auto const & output: outputs)
+        if (mRecord)
         {
-            output->sendLine(this->str());
+            write();
+            releasePendingRecord(std::move(mRecord));
         }
     }
 
     LogStream & operator = (LogStream const & rhs) = delete;
     LogStream & operator = (LogStream && rhs) = delete;
 
-    void ignore ()
+    bool proceed () const
+    {
+        return mRecord != nullptr;
+    }
+
+    std::ostream & stream ()
     {
-        mProceed = false;
+        return mRecord->arena.stream();
     }
 
 private:
-    bool mProceed;
+    void write ()
+    {
+        auto & record = *mRecord;
+        auto & arena = record.arena;
+        bool needText = false;
+        bool needBinary = false;
+        neededFormats(*record.config, needText, needBinary);
+
+        LogRecord sent;
+        sent.flush = record.flush;
+        if (needText)
+        {
+            formatLine(arena.line(), record.time, record.tags,
+                arena.message());
+            sent.line = arena.line();
+        }
+        if (needBinary)
+        {
+            encodeBinaryRecord(arena.binary(), record.time, record.tags,
+                arena.message(), sent.maxKeyId);
+            sent.binary = arena.binary();
+        }
+        if (not needText && not needBinary)
+        {
+            return;
+        }
+
+        auto & writer = getAsyncWriter();
+        if (writer.running() && writer.push(sent, record.config))
+        {
+            return;
+        }
+        sendRecordToOutputs(sent, record.config->outputs);
+    }
+
+    std::unique_ptr<PendingRecord> mRecord;
 };
 
-inline LogStream log (std::vector<Tag const *> tags = {})
+// Anything streamed into the LogStream of a filtered out record
+// is skipped without being formatted.
+template <typename T>
+LogStream & operator << (LogStream & stream, T const & value)
 {
-    auto const now = std::chrono::system_clock::now();
-    std::time_t const tmNow = std::chrono::system_clock::to_time_t(now);
-    auto const ms = duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()) % 1000;
+    if (stream.proceed())
+    {
+        stream.stream() << value;
+    }
+    return stream;
+}
 
-    LogStream ls;
-    ls << std::put_time(std::gmtime(&tmNow), "%Y-%m-%dT%H:%M:%S.")
-        << std::setw(3) << std::setfill('0') << std::to_string(ms.count());
+template <typename T>
+LogStream & operator << (LogStream && stream, T const & value)
+{
+    return stream << value;
+}
 
-    std::map<std::string, Tag const *> activeTags;
-    for (auto const & defaultTag: getDefaultTags())
+// Manipulators such as std::endl are function templates
+// and need their own overloads.
+inline LogStream & operator << (LogStream & stream,
+    std::ostream & (*manipulator) (std::ostream &))
+{
+    if (stream.proceed())
     {
-        activeTags[defaultTag.first] = defaultTag.second.get();
+        manipulator(stream.stream());
     }
-    for (auto const & tag: tags)
+    return stream;
+}
+
+inline LogStream & operator << (LogStream && stream,
+    std::ostream & (*manipulator) (std::ostream &))
+{
+    return stream << manipulator;
+}
+
+// Asks each limit with a matching tag and then the bucket of the
+// call site, if there is one, and stops at the first that leaves
+// the record out. The limits that already let the record through
+// get their token back so that only written records use them up.
+inline bool withinLimits (LogConfig const & config,
+    ActiveTags const & activeTags,
+    TokenBucket * bucket)
+{
+    auto applies = [&activeTags] (LimitRule const & rule)
     {
-        activeTags[tag->key()] = tag;
+        TagData const * active = activeTags.find(rule.tag.data.keyId);
+        return active && active->matches(rule.tag.data);
+    };
+    auto denied = config.limits.end();
+    for (auto it = config.limits.begin(); it != config.limits.end(); ++it)
+    {
+        if (applies(it->second) && not it->second.limit->allow())
+        {
+            denied = it;
+            break;
+        }
     }
-    for (auto const & activeEntry: activeTags)
+    if (denied == config.limits.end() && (not bucket || bucket->take()))
     {
-        ls << " " << activeEntry.second->text();
+        return true;
     }
-    ls << " ";
-
-    bool proceed = true;
-    for (auto const & clause: getFilterClauses())
+    for (auto it = config.limits.begin(); it != denied; ++it)
     {
-        proceed = false;
-        bool allLiteralsMatch = true;
-        for (auto const & normal: clause.second.normalLiterals)
-        {
-            // We need to make sure that the tag is
-            // present and with the correct value.
-            if (not activeTags.contains(normal->key()))
-            {
-                allLiteralsMatch = false;
-                break;
-            }
-            if (not activeTags[normal->key()]->match(*normal))
-            {
-                allLiteralsMatch = false;
-                break;
-            }
-        }
-        if (not allLiteralsMatch)
-        {
-            continue;
-        }
-        for (auto const & inverted: clause.second.invertedLiterals)
+        if (applies(it->second))
         {
-            // We need to make sure that the tag is either
-            // not present or has a mismatched value.
-            if (activeTags.contains(inverted->key()))
-            {
-                if (activeTags[inverted->key()]->match(*inverted))
-                {
-                    allLiteralsMatch = false;
-                }
-                break;
-            }
+            it->second.limit->giveBack();
         }
-        if (allLiteralsMatch)
+    }
+    return false;
+}
+
+// Fills activeTags with the default tags, the context tags and then
+// the tags given to the call. Returns false when the filter or a
+// limit rejects the record. This is checked before anything is
+// formatted so that records which are left out cost very little.
+inline bool selectTags (LogConfig const & config,
+    std::initializer_list<Tag const *> tags,
+    ActiveTags & activeTags,
+    TokenBucket * bucket = nullptr)
+{
+    activeTags.setDefaults(&config.renderedDefaults);
+    for (auto const & tag: getLogContext())
+    {
+        activeTags.set(tag->data());
+    }
+    for (auto const & tag: tags)
+    {
+        activeTags.set(tag->data());
+    }
+
+    auto & counters = threadLogCounters();
+    if (not config.filter.allows(activeTags))
+    {
+        ThreadLogCounters::add(counters.filteredOut);
+        return false;
+    }
+    if (not withinLimits(config, activeTags, bucket))
+    {
+        ThreadLogCounters::add(counters.limited);
+        return false;
+    }
+    ThreadLogCounters::add(counters.emitted);
+    return true;
+}
+
+inline bool needsFlush (LogConfig const & config,
+    ActiveTags const & activeTags)
+{
+    for (auto const & flushTag: config.flushTags)
+    {
+        TagData const * active = activeTags.find(flushTag.data.keyId);
+        if (active && active->matches(flushTag.data))
         {
-            proceed = true;
-            break;
+            return true;
         }
     }
+    return false;
+}
+
+inline LogStream log (std::initializer_list<Tag const *> tags = {},
+    TokenBucket * bucket = nullptr)
+{
+    // The tags are selected into memory kept by the thread so that
+    // a record which is filtered out only costs the filter.
+    thread_local ActiveTags selected;
+    selected.clear();
 
-    if (not proceed)
+    auto const & config = currentLogConfig();
+    if (not selectTags(*config, tags, selected, bucket))
     {
-        ls.ignore();
+        return LogStream();
     }
-    return ls;
+
+    auto record = acquirePendingRecord();
+    record->tags.copyFrom(selected);
+    record->tags.copyTextInto(record->arena.tagText());
+    record->config = config;
+    record->time = std::chrono::system_clock::now();
+    record->flush = needsFlush(*config, selected);
+    return LogStream(std::move(record));
 }
 
 inline auto log (Tag const & tag1)
@@ -642,6 +5256,358 @@ inline auto log (Tag const & tag1,
     return log({&tag1, &tag2, &tag3});
 }
 
+// Used by MEREMEMO_LOG_RATE to give log the bucket of its call site.
+template <typename... TagsT>
+LogStream logWithBucket (TokenBucket & bucket, TagsT const &... tags)
+{
+    return log({static_cast<Tag const *>(&tags)...}, &bucket);
+}
+
+// Calls literal with each run of plain text in format starting at
+// pos and stops just past the next {} placeholder. A doubled brace
+// stands for a single brace. Returns npos when the end of format is
+// reached without finding another placeholder.
+template <typename LiteralT>
+constexpr std::size_t scanLogFormat (std::string_view format,
+    std::size_t pos,
+    LiteralT literal)
+{
+    std::size_t start = pos;
+    while (pos < format.size())
+    {
+        char const ch = format[pos];
+        if (ch != '{' && ch != '}')
+        {
+            ++pos;
+            continue;
+        }
+        literal(format.substr(start, pos - start));
+        if (pos + 1 < format.size() && format[pos + 1] == ch)
+        {
+            start = pos + 1;
+            pos += 2;
+            continue;
+        }
+        if (ch == '{' && pos + 1 < format.size() && format[pos + 1] == '}')
+        {
+            return pos + 2;
+        }
+        throw std::invalid_argument("Log format has an unmatched brace.");
+    }
+    literal(format.substr(start));
+    return std::string_view::npos;
+}
+
+constexpr std::size_t countLogFormatPlaceholders (std::string_view format)
+{
+    std::size_t count = 0;
+    std::size_t pos = 0;
+    while ((pos = scanLogFormat(format, pos,
+        [] (std::string_view) {})) != std::string_view::npos)
+    {
+        ++count;
+    }
+    return count;
+}
+
+// A format string that is checked at compile time. The number of
+// {} placeholders needs to match the number of arguments.
+template <typename... Args>
+class BasicLogFormat
+{
+public:
+    template <typename TextT>
+        requires std::convertible_to<TextT const &, std::string_view>
+    consteval BasicLogFormat (TextT const & text)
+    : mText(text)
+    {
+        if (countLogFormatPlaceholders(mText) != sizeof...(Args))
+        {
+            throw std::invalid_argument(
+                "Log format placeholders do not match the arguments.");
+        }
+    }
+
+    constexpr std::string_view text () const
+    {
+        return mText;
+    }
+
+private:
+    std::string_view mText;
+};
+
+template <typename... Args>
+using LogFormat = BasicLogFormat<std::type_identity_t<Args>...>;
+
+// Numbers are written with std::to_chars which skips the locale
+// and the stream formatting. Bools are written as words.
+template <typename T>
+void writeLogFormatArgument (std::ostream & stream, T const & value)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        stream << (value ? "true" : "false");
+    }
+    else if constexpr (std::is_arithmetic_v<T> &&
+        not std::is_same_v<T, char>)
+    {
+        char buffer[64];
+        auto const result = std::to_chars(
+            buffer, buffer + sizeof(buffer), value);
+        stream.write(buffer, result.ptr - buffer);
+    }
+    else
+    {
+        stream << value;
+    }
+}
+
+template <typename... Args>
+void writeLogFormat (std::ostream & stream,
+    std::string_view format,
+    Args const &... args)
+{
+    auto literal = [&stream] (std::string_view text)
+    {
+        stream.write(text.data(), text.size());
+    };
+    std::size_t pos = 0;
+    auto writeNext = [&] (auto const & arg)
+    {
+        pos = scanLogFormat(format, pos, literal);
+        writeLogFormatArgument(stream, arg);
+    };
+    (writeNext(args), ...);
+    scanLogFormat(format, pos, literal);
+}
+
+// Numbers and text can be copied by the caller and formatted later
+// on the writer thread. Text is copied because the caller's string
+// may be gone by the time the writer gets to it.
+template <typename T>
+constexpr bool isDeferrable = std::is_arithmetic_v<T> ||
+    std::is_convertible_v<T const &, std::string_view>;
+
+template <typename T>
+using DeferredType = std::conditional_t<std::is_arithmetic_v<T>,
+    T, std::string_view>;
+
+template <typename T>
+void captureDeferredArgument (std::string & arguments, T const & value)
+{
+    if constexpr (std::is_arithmetic_v<T>)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        arguments.append(bytes, sizeof(T));
+    }
+    else
+    {
+        std::string_view text = value;
+        std::size_t const size = text.size();
+        char bytes[sizeof(size)];
+        std::memcpy(bytes, &size, sizeof(size));
+        arguments.append(bytes, sizeof(size));
+        arguments += text;
+    }
+}
+
+template <typename T>
+T readDeferredArgument (std::string_view arguments, std::size_t & pos)
+{
+    if constexpr (std::is_arithmetic_v<T>)
+    {
+        T value;
+        std::memcpy(&value, arguments.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    else
+    {
+        std::size_t size;
+        std::memcpy(&size, arguments.data() + pos, sizeof(size));
+        pos += sizeof(size);
+        std::string_view text = arguments.substr(pos, size);
+        pos += size;
+        return text;
+    }
+}
+
+template <typename... Args>
+void formatDeferred (std::ostream & stream,
+    std::string_view format,
+    std::string_view arguments)
+{
+    // The braces make sure the arguments are read in order.
+    std::size_t pos = 0;
+    std::tuple<Args...> values {
+        readDeferredArgument<Args>(arguments, pos)...};
+    std::apply([&] (auto const &... value)
+    {
+        writeLogFormat(stream, format, value...);
+    }, values);
+}
+
+// Copies the tags and the arguments of a record into a slot of the
+// async queue. The format is a compile time string so only its view
+// needs to be kept.
+template <typename... Args>
+void logDeferred (std::initializer_list<Tag const *> tags,
+    std::string_view format,
+    Args const &... args)
+{
+    auto const & config = currentLogConfig();
+    ActiveTags activeTags;
+    if (not selectTags(*config, tags, activeTags))
+    {
+        return;
+    }
+    bool needText = false;
+    bool needBinary = false;
+    neededFormats(*config, needText, needBinary);
+    if (not needText && not needBinary)
+    {
+        return;
+    }
+    bool const flush = needsFlush(*config, activeTags);
+    auto const time = std::chrono::system_clock::now();
+
+    // Everything gets copied and rendered before the queue is locked.
+    // While the lock is held, the record only gets swapped into its
+    // slot and the slot's old memory comes back for the next record.
+    thread_local QueuedRecord record;
+    record.formatter = &formatDeferred<DeferredType<Args>...>;
+    record.format = format;
+    record.time = time;
+    record.flush = flush;
+    record.needText = needText;
+    record.needBinary = needBinary;
+    record.maxKeyId = -1;
+    record.tagText.clear();
+    record.tagBinary.clear();
+    record.tagCount = activeTags.size();
+    if (needText)
+    {
+        appendTagText(record.tagText, activeTags);
+    }
+    if (needBinary)
+    {
+        appendTagBinary(record.tagBinary, activeTags, record.maxKeyId);
+    }
+    record.arguments.clear();
+    (captureDeferredArgument(record.arguments, args), ...);
+    record.config = config;
+
+    bool const queued = getAsyncWriter().pushWith([] (QueuedRecord & slot)
+    {
+        std::swap(slot, record);
+    });
+    record.config.reset();
+    if (queued)
+    {
+        return;
+    }
+
+    // The queue did not take the record so it gets formatted here.
+    auto pending = acquirePendingRecord();
+    formatDeferredRecord(record, pending->arena);
+    releasePendingRecord(std::move(pending));
+    LogRecord sent {record.line, record.binary,
+        record.maxKeyId, record.flush};
+    sendRecordToOutputs(sent, config->outputs);
+}
+
+// Like log but the message comes from a format string with {}
+// placeholders. Nothing gets formatted when the record is
+// filtered out.
+template <typename... Args>
+void logf (std::initializer_list<Tag const *> tags,
+    LogFormat<Args...> format,
+    Args const &... args)
+{
+    if constexpr ((isDeferrable<Args> && ...))
+    {
+        auto & writer = getAsyncWriter();
+        if (writer.running() && writer.defersFormatting())
+        {
+            logDeferred(tags, format.text(), args...);
+            return;
+        }
+    }
+
+    LogStream ls = log(tags);
+    if (ls.proceed())
+    {
+        writeLogFormat(ls.stream(), format.text(), args...);
+    }
+}
+
+template <typename... Args>
+void logf (LogFormat<Args...> format,
+    Args const &... args)
+{
+    logf<Args...>({}, format, args...);
+}
+
+template <typename... Args>
+void logf (Tag const & tag1,
+    LogFormat<Args...> format,
+    Args const &... args)
+{
+    logf<Args...>({&tag1}, format, args...);
+}
+
+template <typename... Args>
+void logf (Tag const & tag1,
+    Tag const & tag2,
+    LogFormat<Args...> format,
+    Args const &... args)
+{
+    logf<Args...>({&tag1, &tag2}, format, args...);
+}
+
+template <typename... Args>
+void logf (Tag const & tag1,
+    Tag const & tag2,
+    Tag const & tag3,
+    LogFormat<Args...> format,
+    Args const &... args)
+{
+    logf<Args...>({&tag1, &tag2, &tag3}, format, args...);
+}
+
 } // namespace MereMemo
 
+// The whole statement including the streamed values is discarded
+// when the log level is ranked below MEREMEMO_MIN_LEVEL.
+#define MEREMEMO_LOG(level, ...) \
+    if constexpr (not MereMemo::isLogLevelEnabled< \
+        std::remove_cvref_t<decltype(level)>>()) \
+    { } \
+    else \
+        MereMemo::log(level __VA_OPT__(,) __VA_ARGS__)
+
+// Like MEREMEMO_LOG but this call site writes at most perSecond
+// records each second. Records that are left out for any other
+// reason do not use up the call site's tokens.
+#define MEREMEMO_LOG_RATE(perSecond, level, ...) \
+    if constexpr (not MereMemo::isLogLevelEnabled< \
+        std::remove_cvref_t<decltype(level)>>()) \
+    { } \
+    else if (static MereMemo::TokenBucket mereMemoBucket( \
+        perSecond, perSecond); false) \
+    { } \
+    else \
+        MereMemo::logWithBucket(mereMemoBucket, \
+            level __VA_OPT__(,) __VA_ARGS__)
+
+// The same for messages written with logf.
+#define MEREMEMO_LOGF(level, ...) \
+    if constexpr (not MereMemo::isLogLevelEnabled< \
+        std::remove_cvref_t<decltype(level)>>()) \
+    { } \
+    else \
+        MereMemo::logf(level, __VA_ARGS__)
+
 #endif // MEREMEMO_LOG_H
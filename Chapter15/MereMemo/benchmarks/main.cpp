@@ -0,0 +1,559 @@
+#include "../Log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Measures the cost of logging a record for a range of cases and
+// prints the results as JSON so that they can be compared between
+// releases. Run with --records N to change the number of records
+// in each case and with --filter text to only run the cases with
+// names that contain the text.
+
+// Every form of operator new is replaced so that all allocations
+// get counted and every form of operator delete is replaced to free
+// memory the same way it was allocated.
+namespace
+{
+    std::atomic<long long> allocationCount {0};
+
+    void * allocate (std::size_t size, std::size_t alignment)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        size = std::max<std::size_t>(size, 1);
+#if defined(_WIN32)
+        return _aligned_malloc(size, alignment);
+#else
+        // The size of an aligned allocation must be
+        // a multiple of the alignment.
+        size = (size + alignment - 1) / alignment * alignment;
+        return std::aligned_alloc(alignment, size);
+#endif
+    }
+
+    void deallocate (void * p) noexcept
+    {
+#if defined(_WIN32)
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    void * allocateOrThrow (std::size_t size, std::size_t alignment)
+    {
+        if (void * p = allocate(size, alignment))
+        {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+
+    constexpr std::size_t defaultAlignment =
+        __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+}
+
+void * operator new (std::size_t size)
+{
+    return allocateOrThrow(size, defaultAlignment);
+}
+
+void * operator new[] (std::size_t size)
+{
+    return allocateOrThrow(size, defaultAlignment);
+}
+
+void * operator new (std::size_t size, std::align_val_t alignment)
+{
+    return allocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new[] (std::size_t size, std::align_val_t alignment)
+{
+    return allocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new (std::size_t size, std::nothrow_t const &) noexcept
+{
+    return allocate(size, defaultAlignment);
+}
+
+void * operator new[] (std::size_t size, std::nothrow_t const &) noexcept
+{
+    return allocate(size, defaultAlignment);
+}
+
+void * operator new (std::size_t size, std::align_val_t alignment,
+    std::nothrow_t const &) noexcept
+{
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new[] (std::size_t size, std::align_val_t alignment,
+    std::nothrow_t const &) noexcept
+{
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete (void * p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete (void * p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete (void * p, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete (void * p, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete (void * p, std::nothrow_t const &) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p, std::nothrow_t const &) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete (void * p, std::align_val_t,
+    std::nothrow_t const &) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[] (void * p, std::align_val_t,
+    std::nothrow_t const &) noexcept
+{
+    deallocate(p);
+}
+
+inline MereMemo::LogLevel error("error");
+inline MereMemo::LogLevel debug("debug");
+
+class Color : public MereMemo::StringTagType<Color>
+{
+public:
+    static constexpr char key[] = "color";
+
+    Color (std::string const & value,
+        MereMemo::TagOperation operation =
+            MereMemo::TagOperation::None)
+    : StringTagType(value, operation)
+    { }
+};
+
+class Count : public MereMemo::IntTagType<Count>
+{
+public:
+    static constexpr char key[] = "count";
+
+    Count (int value,
+        MereMemo::TagOperation operation =
+            MereMemo::TagOperation::None)
+    : IntTagType(value, operation)
+    { }
+};
+
+// A different tag key for each N so that records
+// can have many tags.
+template <int N>
+class Numbered : public MereMemo::IntTagType<Numbered<N>>
+{
+public:
+    static constexpr char key[] = {'n', 'u', 'm',
+        static_cast<char>('a' + N), '\0'};
+
+    Numbered (int value)
+    : MereMemo::IntTagType<Numbered<N>>(value,
+        MereMemo::TagOperation::None)
+    { }
+};
+
+// Accepts every line without writing it anywhere so that only
+// the cost of building the record gets measured.
+class NullOutput : public MereMemo::Output
+{
+public:
+    NullOutput ()
+    { }
+
+    // Output cannot be copied so the base is default constructed.
+    NullOutput (NullOutput const &)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(new NullOutput(*this));
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        mSize += line.size();
+    }
+
+private:
+    std::size_t mSize {0};
+};
+
+struct Options
+{
+    int records {200'000};
+    std::string filter;
+};
+
+struct Result
+{
+    std::string name;
+    int threads;
+    long long records;
+    double nsPerRecord;
+    double allocationsPerRecord;
+};
+
+// Logs records spread across threads. Each thread logs one record
+// first so that its arena and counters are set up before the
+// measuring starts.
+Result measure (std::string name,
+    int records,
+    int threads,
+    std::function<void (int)> const & logOne)
+{
+    int const perThread = std::max(records / threads, 1);
+    std::atomic<int> ready {0};
+    std::atomic<bool> go {false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&] ()
+        {
+            logOne(-1);
+            ++ready;
+            while (not go)
+            {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < perThread; ++i)
+            {
+                logOne(i);
+            }
+        });
+    }
+    while (ready < threads)
+    {
+        std::this_thread::yield();
+    }
+
+    long long const allocationsBefore = allocationCount;
+    auto const start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto & worker: workers)
+    {
+        worker.join();
+    }
+    MereMemo::flushOutputs();
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    long long const allocations = allocationCount - allocationsBefore;
+
+    long long const total = static_cast<long long>(perThread) * threads;
+    auto const ns = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(elapsed).count();
+    return {std::move(name), threads, total,
+        static_cast<double>(ns) / total,
+        static_cast<double>(allocations) / total};
+}
+
+// Replaces the outputs for one case and puts back the
+// outputs that were there before.
+class CaseOutputs
+{
+public:
+    CaseOutputs (MereMemo::Output const & output)
+    {
+        mSaved.push_back(output.clone());
+        MereMemo::swapLogOutputs(mSaved);
+    }
+
+    ~CaseOutputs ()
+    {
+        MereMemo::swapLogOutputs(mSaved);
+    }
+
+private:
+    std::vector<std::shared_ptr<MereMemo::Output>> mSaved;
+};
+
+class CaseFilter
+{
+public:
+    // Only the last clause lets the debug records through so
+    // that every clause gets checked.
+    CaseFilter (int clauses)
+    {
+        for (int i = 0; i < clauses; ++i)
+        {
+            int id = MereMemo::createFilterClause();
+            if (i == clauses - 1)
+            {
+                MereMemo::addFilterLiteral(id, debug);
+            }
+            else
+            {
+                MereMemo::addFilterLiteral(id, Count(-i - 1));
+            }
+            mIds.push_back(id);
+        }
+    }
+
+    ~CaseFilter ()
+    {
+        for (int id: mIds)
+        {
+            MereMemo::clearFilterClause(id);
+        }
+    }
+
+private:
+    std::vector<int> mIds;
+};
+
+void runCases (Options const & options, std::vector<Result> & results)
+{
+    auto wanted = [&options] (std::string_view name)
+    {
+        return name.find(options.filter) != std::string_view::npos;
+    };
+    int const records = options.records;
+
+    Color red("red");
+    Count count(5);
+    std::vector<std::unique_ptr<MereMemo::Tag>> extraTags;
+    auto addExtra = [&extraTags] <int... N> (
+        std::integer_sequence<int, N...>)
+    {
+        (extraTags.push_back(std::make_unique<Numbered<N>>(N)), ...);
+    };
+    addExtra(std::make_integer_sequence<int, 16>());
+
+    if (wanted("filtered_out"))
+    {
+        CaseOutputs outputs {NullOutput()};
+        int filter = MereMemo::createFilterClause();
+        MereMemo::addFilterLiteral(filter, error);
+        results.push_back(measure("filtered_out", records, 1,
+            [&] (int i)
+        {
+            MereMemo::log(debug, red, count) << "filtered out " << i;
+        }));
+        MereMemo::clearFilterClause(filter);
+    }
+
+    for (int tagCount: {0, 4, 16})
+    {
+        std::string name = "tags/" + std::to_string(tagCount);
+        if (not wanted(name))
+        {
+            continue;
+        }
+        std::vector<MereMemo::Tag const *> tags;
+        for (int i = 0; i < tagCount; ++i)
+        {
+            tags.push_back(extraTags[i].get());
+        }
+        CaseOutputs outputs {NullOutput()};
+        results.push_back(measure(name, records, 1, [&] (int i)
+        {
+            // The initializer list form of log takes any
+            // number of tags.
+            switch (tagCount)
+            {
+            case 0:
+                MereMemo::log() << "tags " << i;
+                break;
+            case 4:
+                MereMemo::log({tags[0], tags[1], tags[2], tags[3]})
+                    << "tags " << i;
+                break;
+            default:
+                MereMemo::log({tags[0], tags[1], tags[2], tags[3],
+                    tags[4], tags[5], tags[6], tags[7],
+                    tags[8], tags[9], tags[10], tags[11],
+                    tags[12], tags[13], tags[14], tags[15]})
+                    << "tags " << i;
+                break;
+            }
+        }));
+    }
+
+    for (int clauses: {1, 5, 20})
+    {
+        std::string name = "filter_clauses/" + std::to_string(clauses);
+        if (not wanted(name))
+        {
+            continue;
+        }
+        CaseOutputs outputs {NullOutput()};
+        CaseFilter filter(clauses);
+        results.push_back(measure(name, records, 1, [&] (int i)
+        {
+            MereMemo::log(debug, red) << "clauses " << i;
+        }));
+    }
+
+    if (wanted("output/file"))
+    {
+        std::filesystem::path dir = "benchmark_logs";
+        std::filesystem::remove_all(dir);
+        {
+            CaseOutputs outputs {MereMemo::FileOutput(dir.string())};
+            results.push_back(measure("output/file", records, 1,
+                [&] (int i)
+            {
+                MereMemo::log(debug, red) << "file " << i;
+            }));
+        }
+        std::filesystem::remove_all(dir);
+    }
+
+    if (wanted("output/stream"))
+    {
+#if defined(_WIN32)
+        std::ofstream nullFile("NUL");
+#else
+        std::ofstream nullFile("/dev/null");
+#endif
+        CaseOutputs outputs {MereMemo::StreamOutput(nullFile)};
+        results.push_back(measure("output/stream", records, 1,
+            [&] (int i)
+        {
+            MereMemo::log(debug, red) << "stream " << i;
+        }));
+    }
+
+    for (int threads: {1, 2, 4, 8, 16, 32, 64})
+    {
+        std::string name = "threads/" + std::to_string(threads);
+        if (not wanted(name))
+        {
+            continue;
+        }
+        CaseOutputs outputs {NullOutput()};
+        results.push_back(measure(name, records, threads, [&] (int i)
+        {
+            MereMemo::log(debug, red, count) << "threads " << i;
+        }));
+    }
+
+    // This runs last because the default tags cannot be taken away.
+    // The call site tag goes between the runs of pre-rendered defaults.
+    if (wanted("defaults/8+1"))
+    {
+        auto addDefaults = [] <int... N> (std::integer_sequence<int, N...>)
+        {
+            (MereMemo::addDefaultTag(Numbered<16 + N>(N)), ...);
+        };
+        addDefaults(std::make_integer_sequence<int, 8>());
+        CaseOutputs outputs {NullOutput()};
+        results.push_back(measure("defaults/8+1", records, 1, [&] (int i)
+        {
+            MereMemo::log(error) << "defaults " << i;
+        }));
+    }
+}
+
+void printJson (std::ostream & output, std::vector<Result> const & results)
+{
+    output << "{\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        auto const & result = results[i];
+        output << (i == 0 ? "\n" : ",\n")
+            << "    {\"name\": \"" << result.name << "\""
+            << ", \"threads\": " << result.threads
+            << ", \"records\": " << result.records
+            << ", \"ns_per_record\": " << result.nsPerRecord
+            << ", \"allocations_per_record\": "
+            << result.allocationsPerRecord << "}";
+    }
+    output << "\n  ]\n}" << std::endl;
+}
+
+int main (int argc, char * argv[])
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--records")
+        {
+            options.records = std::max(std::atoi(argv[i + 1]), 1);
+        }
+        else if (arg == "--filter")
+        {
+            options.filter = argv[i + 1];
+        }
+    }
+
+    MereMemo::addDefaultTag(Color("green"));
+
+    std::vector<Result> results;
+    runCases(options, results);
+    printJson(std::cout, results);
+
+    // These cases must not allocate. Anything else
+    // is reported but does not fail the run.
+    for (auto const & result: results)
+    {
+        if ((result.name == "filtered_out" || result.name == "tags/0" ||
+            result.name == "defaults/8+1") &&
+            result.allocationsPerRecord > 0)
+        {
+            std::cerr << result.name << " allocates memory" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,8 +1,10 @@
 #include "../Log.h"
 
+#include "LogTags.h"
 #include "Util.h"
 
 #include <MereTDD/Test.h>
+#include <fstream>
 
 TEST("Simple message can be logged")
 {
@@ -10,7 +12,7 @@ TEST("Simple message can be logged")
     message += Util::randomString();
     MereMemo::log() << message << " with more text.";
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_TRUE(result);
 }
 
@@ -22,6 +24,90 @@ TEST("Complicated message can be logged")
         << " double=" << 3.14
         << " quoted=" << std::quoted("in quotes");
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_TRUE(result);
 }
+
+TEST("Message can be logged with a format string")
+{
+    std::string message = "format ";
+    message += Util::randomString();
+    MereMemo::logf(info, "{} int={} double={} bool={} {{braces}}",
+        message, 42, 2.5, true);
+
+    bool result = Util::isTextInFile(
+        message + " int=42 double=2.5 bool=true {braces}",
+        "logs/application.log", {"log_level=\"info\""});
+    CONFIRM_TRUE(result);
+}
+
+TEST("Stream settings do not carry over to the next message")
+{
+    std::string message = "settings ";
+    message += Util::randomString();
+    MereMemo::log() << message << " hex=" << std::hex << 255;
+    MereMemo::log() << message << " dec=" << 255;
+
+    bool result = Util::isTextInFile(message + " hex=ff",
+        "logs/application.log");
+    CONFIRM_TRUE(result);
+    result = Util::isTextInFile(message + " dec=255",
+        "logs/application.log");
+    CONFIRM_TRUE(result);
+}
+
+TEST("Named stream keeps the text of temporary tags")
+{
+    std::string message = "named ";
+    message += Util::randomString();
+    std::string color(100, 'x');
+    {
+        // The tag is gone by the time the stream writes the record.
+        // Under a sanitizer any use of its text is reported and the
+        // string below likely takes over the memory it had.
+        auto stream = MereMemo::log(Color(color));
+        std::string reused(color.size() + 8, 'y');
+        stream << message << " " << reused.size();
+    }
+
+    bool result = Util::isTextInFile(message, "logs/application.log",
+        {"color=\"" + color + "\""});
+    CONFIRM_TRUE(result);
+}
+
+TEST("Flush tag writes buffered message right away")
+{
+    std::string message = "flushed ";
+    message += Util::randomString();
+    MereMemo::log(error) << message;
+
+    // Read the file directly because the utility
+    // function would flush the outputs first.
+    std::ifstream logfile("logs/application.log");
+    std::string line;
+    bool result = false;
+    while (getline(logfile, line))
+    {
+        if (line.find(message) != std::string::npos)
+        {
+            result = true;
+            break;
+        }
+    }
+    CONFIRM_TRUE(result);
+}
+
+TEST("Timestamp is formatted with milliseconds")
+{
+    using namespace std::chrono;
+    sys_days const day = year(2022) / June / 5;
+    auto const time = day + hours(7) + minutes(8) + seconds(9) +
+        milliseconds(12);
+
+    MereMemo::TimestampCache cache;
+    std::string result(cache.format(time));
+    CONFIRM_THAT(result, MereTDD::Equals("2022-06-05T07:08:09.012"));
+
+    result = cache.format(time + milliseconds(990));
+    CONFIRM_THAT(result, MereTDD::Equals("2022-06-05T07:08:10.002"));
+}
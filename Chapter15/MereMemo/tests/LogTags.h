@@ -6,6 +6,8 @@
 inline MereMemo::LogLevel error("error");
 inline MereMemo::LogLevel info("info");
 inline MereMemo::LogLevel debug("debug");
+// This is ranked below the default minimum level.
+inline MereMemo::RankedLogLevel<-10> trace("trace");
 
 class Color : public MereMemo::StringTagType<Color>
 {
@@ -0,0 +1,636 @@
+#include "../Log.h"
+
+#include "LogTags.h"
+#include "Util.h"
+
+#include <MereTDD/Test.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+TEST("File output rolls over at max size")
+{
+    std::filesystem::path dir = "rollover_logs";
+    std::filesystem::remove_all(dir);
+    {
+        MereMemo::FileOutput rolloverFile(dir.string());
+        rolloverFile.namePattern() = "rollover{}.log";
+        rolloverFile.maxSize() = 100;
+        rolloverFile.rolloverCount() = 2;
+        rolloverFile.bufferSize() = 0;
+
+        // Each line is 50 bytes with the newline so every
+        // two lines will fill a file.
+        std::string line(49, 'x');
+        for (int i = 0; i < 10; ++i)
+        {
+            rolloverFile.sendLine(line);
+        }
+    }
+
+    CONFIRM_TRUE(std::filesystem::exists(dir / "rollover.log"));
+    CONFIRM_TRUE(std::filesystem::exists(dir / "rollover1.log"));
+    CONFIRM_TRUE(std::filesystem::exists(dir / "rollover2.log"));
+    CONFIRM_FALSE(std::filesystem::exists(dir / "rollover3.log"));
+    CONFIRM_FALSE(std::filesystem::exists(dir / "rollover-rolling.log"));
+    CONFIRM_THAT(std::filesystem::file_size(dir / "rollover.log"),
+        MereTDD::Equals(100u));
+    CONFIRM_THAT(std::filesystem::file_size(dir / "rollover2.log"),
+        MereTDD::Equals(100u));
+}
+
+TEST("File output writes a batch of lines")
+{
+    std::filesystem::path dir = "batch_logs";
+    std::filesystem::remove_all(dir);
+    {
+        MereMemo::FileOutput batchFile(dir.string());
+        batchFile.namePattern() = "batch{}.log";
+        batchFile.maxSize() = 100;
+        batchFile.rolloverCount() = 1;
+        batchFile.bufferSize() = 30;
+
+        // The first batch stays in the buffer, the second is written
+        // together with the buffer and the third needs a rollover.
+        std::string filler(29, 'x');
+        std::string line(49, 'y');
+        std::string_view first[] = {"one"};
+        std::string_view second[] = {"two", filler};
+        std::string_view third[] = {line, line};
+        batchFile.sendLines(first);
+        batchFile.sendLines(second);
+        batchFile.sendLines(third);
+    }
+
+    std::ifstream rolled(dir / "batch1.log");
+    std::stringstream rolledText;
+    rolledText << rolled.rdbuf();
+    CONFIRM_THAT(rolledText.str(), MereTDD::Equals(
+        "one\ntwo\n" + std::string(29, 'x') + "\n" +
+        std::string(49, 'y') + "\n"));
+    CONFIRM_THAT(std::filesystem::file_size(dir / "batch.log"),
+        MereTDD::Equals(50u));
+}
+
+TEST("File output batch rolls over a file left by an earlier run")
+{
+    std::filesystem::path dir = "earlier_logs";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+        std::ofstream earlier(dir / "earlier.log");
+        earlier << std::string(89, 'x') << '\n';
+    }
+    {
+        MereMemo::FileOutput earlierFile(dir.string());
+        earlierFile.namePattern() = "earlier{}.log";
+        earlierFile.maxSize() = 100;
+        earlierFile.rolloverCount() = 1;
+        earlierFile.bufferSize() = 30;
+
+        std::string line(49, 'y');
+        std::string_view batch[] = {line};
+        earlierFile.sendLines(batch);
+    }
+
+    CONFIRM_THAT(std::filesystem::file_size(dir / "earlier1.log"),
+        MereTDD::Equals(90u));
+    CONFIRM_THAT(std::filesystem::file_size(dir / "earlier.log"),
+        MereTDD::Equals(50u));
+}
+
+#if defined(__linux__)
+TEST("File output keeps a batch that cannot be written")
+{
+    // Every write to /dev/full fails.
+    MereMemo::FileOutput fullFile("/dev");
+    fullFile.namePattern() = "full";
+    fullFile.bufferSize() = 100;
+
+    std::string line(59, 'z');
+    std::string_view batch[] = {line, line};
+    fullFile.sendLines(batch);
+    CONFIRM_THAT(fullFile.droppedBytes(), MereTDD::Equals(0ull));
+
+    // Only once the lines fill the buffers that can be held
+    // are they counted and dropped.
+    for (int i = 0; i < 3; ++i)
+    {
+        fullFile.sendLines(batch);
+    }
+    CONFIRM_THAT(fullFile.droppedBytes(), MereTDD::Equals(480ull));
+}
+
+TEST("Stats show the bytes dropped by a registered output")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    MereMemo::FileOutput fullFile("/dev");
+    fullFile.namePattern() = "full";
+    fullFile.bufferSize() = 100;
+    MereMemo::addLogOutput(fullFile);
+
+    std::string message(200, 'z');
+    for (int i = 0; i < 4; ++i)
+    {
+        MereMemo::log() << message;
+    }
+    MereMemo::LogStats stats = MereMemo::stats();
+    CONFIRM_THAT(stats.outputs.size(), MereTDD::Equals(1u));
+    CONFIRM_TRUE(stats.outputs[0].droppedBytes > 0);
+}
+#endif
+
+TEST("Registered outputs can be synced")
+{
+    std::filesystem::path dir = "sync_logs";
+    std::filesystem::remove_all(dir);
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    MereMemo::FileOutput syncFile(dir.string());
+    syncFile.namePattern() = "sync{}.log";
+    syncFile.flushInterval() = std::chrono::hours(1);
+    MereMemo::addLogOutput(syncFile);
+
+    // The first line is written right away and the next one waits
+    // in the buffer. The file is read directly because isTextInFile
+    // would flush the outputs.
+    auto contents = [&dir] ()
+    {
+        std::ifstream file(dir / "sync.log");
+        std::stringstream text;
+        text << file.rdbuf();
+        return text.str();
+    };
+    MereMemo::log() << "sync first";
+    std::string message = "sync " + Util::randomString();
+    MereMemo::log() << message;
+    CONFIRM_THAT(contents().find(message), MereTDD::Equals(std::string::npos));
+
+    MereMemo::syncOutputs();
+    CONFIRM_TRUE(contents().find(message) != std::string::npos);
+}
+
+TEST("Binary output can be decoded to text")
+{
+    std::filesystem::path dir = "binary_logs";
+    std::filesystem::remove_all(dir);
+
+    std::string message = "binary ";
+    message += Util::randomString();
+    {
+        MereTDD::SetupAndTeardown<TempOutputs> outputs;
+        MereMemo::addLogOutput(MereMemo::BinaryFileOutput(dir.string()));
+        MereMemo::log(error, Count(5), Scale(1.5)) << message;
+        MereMemo::log(cacheHit) << message << " second";
+        MereMemo::flushOutputs();
+    }
+
+    std::ifstream input(dir / "application.mlog", std::ios::binary);
+    std::stringstream decoded;
+    bool result = MereMemo::decodeBinaryLog(input, decoded);
+    CONFIRM_TRUE(result);
+
+    std::string line;
+    std::getline(decoded, line);
+    CONFIRM_TRUE(line.ends_with(" " + message));
+    CONFIRM_TRUE(line.find(" log_level=\"error\" ") != std::string::npos);
+    CONFIRM_TRUE(line.find(" color=\"green\" ") != std::string::npos);
+    CONFIRM_TRUE(line.find(" count=5 ") != std::string::npos);
+    CONFIRM_TRUE(line.find(" scale=1.500000 ") != std::string::npos);
+
+    std::getline(decoded, line);
+    CONFIRM_TRUE(line.ends_with(" " + message + " second"));
+    CONFIRM_TRUE(line.find(" cache_hit=true ") != std::string::npos);
+    CONFIRM_TRUE(line.find(" log_level=\"info\" ") != std::string::npos);
+}
+
+TEST("Binary log with a corrupt size is rejected")
+{
+    // A key entry whose name claims to be almost 4GB long.
+    std::string data(MereMemo::binaryLogMagic);
+    MereMemo::appendBinary(data, MereMemo::binaryLogVersion);
+    data += MereMemo::binaryKeyEntry;
+    MereMemo::appendBinary(data, static_cast<std::uint32_t>(0));
+    MereMemo::appendBinary(data, static_cast<std::uint32_t>(0xfffffff0));
+    data += "short";
+
+    std::stringstream input(data);
+    std::stringstream decoded;
+    CONFIRM_FALSE(MereMemo::decodeBinaryLog(input, decoded));
+    CONFIRM_TRUE(decoded.str().empty());
+}
+
+#if defined(__linux__)
+// Only used by the next test so that its key gets defined last.
+class DropMark : public MereMemo::IntTagType<DropMark>
+{
+public:
+    static constexpr char key[] = "drop_mark";
+
+    DropMark (int value)
+    : IntTagType(value, MereMemo::TagOperation::None)
+    { }
+};
+
+TEST("Binary output defines its keys again after a dropped buffer")
+{
+    std::filesystem::path dir = "dropped_binary_logs";
+    std::filesystem::remove_all(dir);
+
+    std::string message = "after drop ";
+    message += Util::randomString();
+    {
+        MereTDD::SetupAndTeardown<TempOutputs> outputs;
+        MereMemo::BinaryFileOutput binaryFile(dir.string());
+        binaryFile.bufferSize() = 1;
+        MereMemo::addLogOutput(binaryFile);
+        MereMemo::log(error) << "before drop";
+
+        // A file size limit makes the next write fail so the buffer
+        // with the definition of the new key gets dropped.
+        rlimit saved;
+        getrlimit(RLIMIT_FSIZE, &saved);
+        auto savedHandler = std::signal(SIGXFSZ, SIG_IGN);
+        rlimit limit = saved;
+        limit.rlim_cur = std::filesystem::file_size(dir / "application.mlog");
+        setrlimit(RLIMIT_FSIZE, &limit);
+        MereMemo::log(error, DropMark(1)) << "dropped";
+        setrlimit(RLIMIT_FSIZE, &saved);
+        std::signal(SIGXFSZ, savedHandler);
+        CONFIRM_TRUE(MereMemo::stats().outputs[0].droppedBytes > 0);
+
+        MereMemo::log(error, DropMark(2)) << message;
+        MereMemo::flushOutputs();
+    }
+
+    std::ifstream input(dir / "application.mlog", std::ios::binary);
+    std::stringstream decoded;
+    bool result = MereMemo::decodeBinaryLog(input, decoded);
+    CONFIRM_TRUE(result);
+    std::string line;
+    std::getline(decoded, line);
+    CONFIRM_TRUE(line.ends_with(" before drop"));
+    std::getline(decoded, line);
+    CONFIRM_TRUE(line.ends_with(" " + message));
+    CONFIRM_TRUE(line.find(" drop_mark=2 ") != std::string::npos);
+}
+#endif
+
+TEST("Mapped ring output keeps the newest lines")
+{
+    std::filesystem::path dir = "ring_logs";
+    std::filesystem::remove_all(dir);
+
+    // Each line is 20 bytes with the newline so the
+    // ring holds 50 lines.
+    auto makeLine = [] (int i)
+    {
+        std::string line = "ring line ";
+        line += std::to_string(1000 + i);
+        line += std::string(5, 'x');
+        return line;
+    };
+    {
+        MereMemo::MappedRingOutput ring(dir.string());
+        ring.capacity() = 1000;
+        for (int i = 0; i < 100; ++i)
+        {
+            ring.sendLine(makeLine(i));
+        }
+    }
+    {
+        // A ring from an earlier run is continued.
+        MereMemo::MappedRingOutput ring(dir.string());
+        ring.capacity() = 1000;
+        ring.sendLine(makeLine(100));
+    }
+
+    std::ifstream input(dir / "application.ring", std::ios::binary);
+    std::stringstream recovered;
+    bool result = MereMemo::recoverMappedRing(input, recovered);
+    CONFIRM_TRUE(result);
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (getline(recovered, line))
+    {
+        lines.push_back(line);
+    }
+    CONFIRM_TRUE(lines.size() >= 49u);
+    CONFIRM_THAT(lines.back(), MereTDD::Equals(makeLine(100)));
+    CONFIRM_THAT(lines.front(),
+        MereTDD::Equals(makeLine(101 - static_cast<int>(lines.size()))));
+
+    input.clear();
+    input.seekg(0);
+    std::stringstream newest;
+    result = MereMemo::recoverMappedRing(input, newest, 100);
+    CONFIRM_TRUE(result);
+    CONFIRM_THAT(newest.str().size(), MereTDD::Equals(100u));
+    CONFIRM_TRUE(newest.str().starts_with(makeLine(96)));
+}
+
+TEST("Compressed output can be read back by time window")
+{
+    std::filesystem::path dir = "compressed_logs";
+    std::filesystem::remove_all(dir);
+
+    auto makeLine = [] (int i)
+    {
+        std::string line = "2022-06-25T20:01:";
+        line += std::to_string(10 + i);
+        line += ".000 log_level=\"info\" color=\"green\" message ";
+        line += std::to_string(i);
+        return line;
+    };
+    std::string all;
+    {
+        MereMemo::CompressedFileOutput compressed(dir.string());
+        compressed.bufferSize() = 1000;
+        compressed.flushInterval() = std::chrono::hours(1);
+        for (int i = 0; i < 40; ++i)
+        {
+            compressed.sendLine(makeLine(i));
+            all += makeLine(i) + "\n";
+        }
+    }
+    auto const file = dir / "application.mlz";
+    CONFIRM_TRUE(std::filesystem::file_size(file) < all.size() / 2);
+
+    std::ifstream input(file, std::ios::binary);
+    std::stringstream decompressed;
+    bool result = MereMemo::decompressLog(input, decompressed);
+    CONFIRM_TRUE(result);
+    CONFIRM_THAT(decompressed.str(), MereTDD::Equals(all));
+
+    input.clear();
+    input.seekg(0);
+    std::stringstream window;
+    result = MereMemo::decompressLog(input, window,
+        "2022-06-25T20:01:20", "2022-06-25T20:01:24");
+    CONFIRM_TRUE(result);
+    CONFIRM_THAT(window.str(), MereTDD::Equals(makeLine(10) + "\n" +
+        makeLine(11) + "\n" + makeLine(12) + "\n" + makeLine(13) + "\n" +
+        makeLine(14) + "\n"));
+}
+
+TEST("Compressed log index is used to find the blocks")
+{
+    std::filesystem::path dir = "indexed_logs";
+    std::filesystem::remove_all(dir);
+
+    auto makeLine = [] (int i)
+    {
+        std::string line = "2022-06-25T20:02:";
+        line += std::to_string(10 + i);
+        line += ".000 log_level=\"info\" indexed ";
+        line += std::to_string(i);
+        return line;
+    };
+    auto writeLines = [&dir, &makeLine] (int begin, int end)
+    {
+        MereMemo::CompressedFileOutput compressed(dir.string());
+        compressed.bufferSize() = 100;
+        compressed.flushInterval() = std::chrono::hours(1);
+        for (int i = begin; i < end; ++i)
+        {
+            compressed.sendLine(makeLine(i));
+        }
+    };
+    auto window = [&makeLine] (int begin, int end)
+    {
+        std::string text;
+        for (int i = begin; i < end; ++i)
+        {
+            text += makeLine(i) + "\n";
+        }
+        return text;
+    };
+    auto const file = dir / "application.mlz";
+    writeLines(0, 40);
+
+    // The size of the first block gets broken. Only a reader that
+    // hops from one block header to the next would notice.
+    {
+        std::fstream corrupt(file,
+            std::ios::in | std::ios::out | std::ios::binary);
+        corrupt.seekp(sizeof(MereMemo::compressedLogMagic));
+        corrupt.write("\xff\xff\xff\x7f", 4);
+    }
+    std::ifstream input(file, std::ios::binary);
+    std::stringstream decompressed;
+    bool result = MereMemo::decompressLog(input, decompressed,
+        "2022-06-25T20:02:40", "2022-06-25T20:02:44");
+    CONFIRM_TRUE(result);
+    CONFIRM_THAT(decompressed.str(), MereTDD::Equals(window(30, 35)));
+    input.close();
+
+    // Appending to a finished file leaves the old index in the
+    // middle and no index at the end so every header gets read.
+    std::filesystem::remove_all(dir);
+    writeLines(0, 20);
+    writeLines(20, 40);
+    input.open(file, std::ios::binary);
+    decompressed.str("");
+    result = MereMemo::decompressLog(input, decompressed);
+    CONFIRM_TRUE(result);
+    CONFIRM_THAT(decompressed.str(), MereTDD::Equals(window(0, 40)));
+}
+
+TEST("Stats count records and output bytes")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::stringstream stream;
+    MereMemo::addLogOutput(MereMemo::StreamOutput(stream));
+
+    MereMemo::LogStats before = MereMemo::stats();
+    int filter = MereMemo::createFilterClause();
+    MereMemo::addFilterLiteral(filter, error);
+    MereMemo::log(info) << "filtered out";
+    MereMemo::log(error) << "counted";
+    MereMemo::clearFilterClause(filter);
+    MereMemo::LogStats after = MereMemo::stats();
+
+    CONFIRM_THAT(after.emitted - before.emitted, MereTDD::Equals(1ull));
+    CONFIRM_THAT(after.filteredOut - before.filteredOut,
+        MereTDD::Equals(1ull));
+    CONFIRM_THAT(after.outputs.size(), MereTDD::Equals(1u));
+
+    auto const & output = after.outputs[0];
+    CONFIRM_THAT(output.name, MereTDD::Equals("stream"));
+    CONFIRM_THAT(output.lines, MereTDD::Equals(1ull));
+    CONFIRM_THAT(output.bytes, MereTDD::Equals(stream.str().size()));
+    unsigned long long sends = 0;
+    for (auto count: output.latency)
+    {
+        sends += count;
+    }
+    CONFIRM_THAT(sends, MereTDD::Equals(1ull));
+
+    // The async writer waits in a gated output with the first record
+    // and holds its lock. The queue fills, a record is dropped and a
+    // flush from another thread has to wait for the lock.
+    std::atomic<bool> open {false};
+    std::size_t gateCount = 0;
+    MereMemo::addLogOutput(GateOutput(open, gateCount));
+    Identity id(-190);
+    int limit = MereMemo::addRateLimit(id, 0.001, 1);
+    MereMemo::enableAsyncLogging(2, MereMemo::QueueFullPolicy::Drop);
+
+    before = MereMemo::stats();
+    MereMemo::log(id) << "gated";
+    Util::waitForEmptyLogQueue();
+    MereMemo::log(id) << "limited";
+    MereMemo::log() << "queued 1";
+    MereMemo::log() << "queued 2";
+    MereMemo::log() << "dropped";
+    std::thread flusher([] ()
+    {
+        MereMemo::flushOutputs();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    MereMemo::LogStats full = MereMemo::stats();
+    open = true;
+    flusher.join();
+    MereMemo::disableAsyncLogging();
+    MereMemo::removeLogLimit(limit);
+    after = MereMemo::stats();
+
+    CONFIRM_THAT(full.queueDepth, MereTDD::Equals(2u));
+    CONFIRM_TRUE(full.maxQueueDepth >= 2);
+    CONFIRM_THAT(after.queueDepth, MereTDD::Equals(0u));
+    CONFIRM_THAT(after.dropped - before.dropped, MereTDD::Equals(1ull));
+    CONFIRM_THAT(after.limited - before.limited, MereTDD::Equals(1ull));
+    CONFIRM_THAT(gateCount, MereTDD::Equals(3u));
+
+    CONFIRM_THAT(after.outputs.size(), MereTDD::Equals(2u));
+    auto const & gated = after.outputs[1];
+    auto const & gatedBefore = before.outputs[1];
+    CONFIRM_THAT(gated.lines - gatedBefore.lines, MereTDD::Equals(3ull));
+    CONFIRM_TRUE(gated.contendedLocks > gatedBefore.contendedLocks);
+    CONFIRM_TRUE(gated.lockWait > gatedBefore.lockWait);
+}
+
+TEST("Log query compares whole and decimal numbers")
+{
+    std::string log =
+        "2022-06-25T20:10:00.000 scale=1.500000 count=5 first\n"
+        "2022-06-25T20:11:00.000 scale=2.000000 count=7 second\n"
+        "2022-06-25T20:12:00.000 scale=0.500000 count=6 third\n";
+
+    auto find = [&log] (std::string_view predicate)
+    {
+        MereMemo::LogQuery query;
+        query.tags.push_back(MereMemo::parseLogTagPredicate(predicate));
+        std::string found;
+        for (auto const & line: MereMemo::queryLog(log, query))
+        {
+            found += line.substr(line.rfind(' ') + 1);
+            found += ' ';
+        }
+        return found;
+    };
+    // Whole numbers in the query against decimals in the log.
+    CONFIRM_THAT(find("scale>1"), MereTDD::Equals("first second "));
+    CONFIRM_THAT(find("scale=2"), MereTDD::Equals("second "));
+    CONFIRM_THAT(find("scale<=1"), MereTDD::Equals("third "));
+    // Decimals in the query against whole numbers in the log.
+    CONFIRM_THAT(find("count>5.5"), MereTDD::Equals("second third "));
+    CONFIRM_THAT(find("count=7.0"), MereTDD::Equals("second "));
+
+    CONFIRM_TRUE(MereMemo::compareTagValues(2,
+        MereMemo::TagOperation::Equal, 2.0));
+    CONFIRM_TRUE(MereMemo::compareTagValues(1.5,
+        MereMemo::TagOperation::GreaterThan, 1));
+    CONFIRM_TRUE(MereMemo::compareTagValues(5,
+        MereMemo::TagOperation::LessThan, 5.5));
+    CONFIRM_FALSE(MereMemo::compareTagValues(1,
+        MereMemo::TagOperation::Equal, true));
+}
+
+TEST("Log query only looks for tags before the message")
+{
+    std::string log =
+        "2022-06-25T20:10:00.000 color=\"red\" message count=9\n"
+        "2022-06-25T20:11:00.000 color=\"a count=9 b\" count=2 quoted\n"
+        "2022-06-25T20:12:00.000 color=\"red\" count=9 tagged\n";
+
+    MereMemo::LogQuery query;
+    query.tags.push_back(MereMemo::parseLogTagPredicate("count=9"));
+    auto lines = MereMemo::queryLog(log, query);
+    CONFIRM_THAT(lines.size(), MereTDD::Equals(1u));
+    CONFIRM_TRUE(lines.front().ends_with(" tagged"));
+}
+
+TEST("Log query finds lines by time, text and tag")
+{
+    std::string log;
+    for (int i = 0; i < 60; ++i)
+    {
+        std::string time = i < 50 ?
+            "2022-06-25T20:" + std::to_string(10 + i) :
+            "2022-06-25T21:" + std::to_string(i - 40);
+        log += time + ":00.000 log_level=\"" +
+            (i % 3 == 0 ? "error" : "info") + "\" count=" +
+            std::to_string(i) + " message " + std::to_string(i) + "\n";
+    }
+
+    MereMemo::LogQuery query;
+    query.from = "2022-06-25T20:20";
+    query.to = "2022-06-25T20:29";
+    query.tags.push_back(MereMemo::parseLogTagPredicate(
+        "log_level=error"));
+    auto lines = MereMemo::queryLog(log, query);
+    CONFIRM_THAT(lines.size(), MereTDD::Equals(3u));
+    CONFIRM_TRUE(lines.front().ends_with(" message 12"));
+    CONFIRM_TRUE(lines.back().ends_with(" message 18"));
+
+    // The log is small so each thread gets only a few lines.
+    MereMemo::LogQuery countQuery;
+    countQuery.tags.push_back(MereMemo::makeLogTagPredicate(
+        Count(55, MereMemo::TagOperation::GreaterThanOrEqual)));
+    countQuery.text.push_back("message");
+    countQuery.threads = 4;
+    lines = MereMemo::queryLog(log, countQuery);
+    CONFIRM_THAT(lines.size(), MereTDD::Equals(5u));
+    CONFIRM_TRUE(lines.front().ends_with(" message 55"));
+    CONFIRM_TRUE(lines.back().ends_with(" message 59"));
+}
+
+TEST("File output writes held lines after the flush interval")
+{
+    std::filesystem::path dir = "interval_logs";
+    std::filesystem::remove_all(dir);
+
+    std::string message = "interval ";
+    message += Util::randomString();
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    MereMemo::FileOutput intervalFile(dir.string());
+    intervalFile.flushInterval() = std::chrono::milliseconds(50);
+    MereMemo::addLogOutput(intervalFile);
+
+    // The first line is written right away and the second
+    // stays in the buffer until the interval has passed.
+    MereMemo::log(error) << message << " first";
+    MereMemo::log(error) << message << " second";
+
+    bool found = false;
+    for (int i = 0; i < 50 && not found; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::ifstream input(dir / "application.log");
+        std::stringstream text;
+        text << input.rdbuf();
+        found = text.str().find(message + " second") != std::string::npos;
+    }
+    CONFIRM_TRUE(found);
+}
@@ -4,6 +4,7 @@
 #include "Util.h"
 
 #include <MereTDD/Test.h>
+#include <sstream>
 
 class TempFilterClause
 {
@@ -37,7 +38,7 @@ TEST("Message can be tagged in log")
     // default info tag value does not.
     std::string logLevelTag = " log_level=\"error\" ";
     std::string defaultLogLevelTag = " log_level=\"info\" ";
-    bool result = Util::isTextInFile(message, "application.log",
+    bool result = Util::isTextInFile(message, "logs/application.log",
         {logLevelTag}, {defaultLogLevelTag});
     CONFIRM_TRUE(result);
 }
@@ -55,11 +56,24 @@ TEST("Default tags set in main appear in log")
 
     std::string logLevelTag = " log_level=\"info\" ";
     std::string colorTag = " color=\"green\" ";
-    bool result = Util::isTextInFile(message, "application.log",
+    bool result = Util::isTextInFile(message, "logs/application.log",
         {logLevelTag, colorTag});
     CONFIRM_TRUE(result);
 }
 
+TEST("Tags are merged with the defaults in key name order")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::stringstream stream;
+    MereMemo::addLogOutput(MereMemo::StreamOutput(stream));
+
+    // Count goes between the two defaults from main, error takes
+    // the place of the default log level and size comes last.
+    MereMemo::log(large, error, Count(3)) << "merged";
+    CONFIRM_TRUE(stream.str().ends_with(" color=\"green\" count=3 "
+        "log_level=\"error\" size=\"large\" merged\n"));
+}
+
 TEST("Multiple tags can be used in log")
 {
     std::string message = "multi tags ";
@@ -69,7 +83,7 @@ TEST("Multiple tags can be used in log")
     std::string logLevelTag = " log_level=\"debug\" ";
     std::string colorTag = " color=\"red\" ";
     std::string sizeTag = " size=\"large\" ";
-    bool result = Util::isTextInFile(message, "application.log",
+    bool result = Util::isTextInFile(message, "logs/application.log",
         {logLevelTag, colorTag, sizeTag});
     CONFIRM_TRUE(result);
 }
@@ -81,7 +95,7 @@ TEST("Tags can be streamed to log")
     MereMemo::log(info) << Count(1) << message;
 
     std::string countTag = " count=1 ";
-    bool result = Util::isTextInFile(message, "application.log",
+    bool result = Util::isTextInFile(message, "logs/application.log",
         {countTag});
     CONFIRM_TRUE(result);
 
@@ -90,7 +104,7 @@ TEST("Tags can be streamed to log")
     MereMemo::log(info) << Identity(123456789012345) << message;
 
     std::string idTag = " id=123456789012345 ";
-    result = Util::isTextInFile(message, "application.log",
+    result = Util::isTextInFile(message, "logs/application.log",
         {idTag});
     CONFIRM_TRUE(result);
 
@@ -99,7 +113,7 @@ TEST("Tags can be streamed to log")
     MereMemo::log(info) << Scale(1.5) << message;
 
     std::string scaleTag = " scale=1.500000 ";
-    result = Util::isTextInFile(message, "application.log",
+    result = Util::isTextInFile(message, "logs/application.log",
         {scaleTag});
     CONFIRM_TRUE(result);
 
@@ -108,7 +122,7 @@ TEST("Tags can be streamed to log")
     MereMemo::log(info) << cacheMiss << message;
 
     std::string cacheTag = " cache_hit=false ";
-    result = Util::isTextInFile(message, "application.log",
+    result = Util::isTextInFile(message, "logs/application.log",
         {cacheTag});
     CONFIRM_TRUE(result);
 }
@@ -122,14 +136,14 @@ TEST("Tags can be used to filter messages")
     message += Util::randomString();
     MereMemo::log(info) << message;
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_FALSE(result);
 
     MereMemo::clearFilterClause(filter.id());
 
     MereMemo::log(info) << message;
 
-    result = Util::isTextInFile(message, "application.log");
+    result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_TRUE(result);
 }
 
@@ -142,7 +156,7 @@ TEST("Overridden default tag not used to filter messages")
     message += Util::randomString();
     MereMemo::log(debug) << message;
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_FALSE(result);
 }
 
@@ -155,7 +169,7 @@ TEST("Inverted tag can be used to filter messages")
     message += Util::randomString();
     MereMemo::log(info) << message;
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_FALSE(result);
 }
 
@@ -169,16 +183,305 @@ TEST("Tag values can be used to filter messages")
     message += Util::randomString();
     MereMemo::log(Count(1)) << message;
 
-    bool result = Util::isTextInFile(message, "application.log");
+    bool result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_FALSE(result);
 
     MereMemo::log() << Count(101) << message;
 
-    result = Util::isTextInFile(message, "application.log");
+    result = Util::isTextInFile(message, "logs/application.log");
     CONFIRM_FALSE(result);
 
     MereMemo::log(Count(101)) << message;
 
-    result = Util::isTextInFile(message, "application.log");
+    result = Util::isTextInFile(message, "logs/application.log");
+    CONFIRM_TRUE(result);
+}
+
+struct FormatCounter
+{
+    int & mCount;
+};
+
+std::ostream & operator << (std::ostream & stream,
+    FormatCounter const & counter)
+{
+    ++counter.mCount;
+    return stream;
+}
+
+TEST("Filtered out messages are not formatted")
+{
+    MereTDD::SetupAndTeardown<TempFilterClause> filter;
+    MereMemo::addFilterLiteral(filter.id(), error);
+
+    int count = 0;
+    MereMemo::log(info) << "not formatted " << FormatCounter {count};
+    CONFIRM_THAT(count, MereTDD::Equals(0));
+
+    MereMemo::log(error) << "formatted " << FormatCounter {count};
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+}
+
+TEST("Filtered out logf messages are not formatted")
+{
+    MereTDD::SetupAndTeardown<TempFilterClause> filter;
+    MereMemo::addFilterLiteral(filter.id(), error);
+
+    int count = 0;
+    MereMemo::logf(info, "not formatted {}", FormatCounter {count});
+    CONFIRM_THAT(count, MereTDD::Equals(0));
+
+    MereMemo::logf(error, "formatted {}", FormatCounter {count});
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+}
+
+TEST("Log levels below the minimum rank are compiled out")
+{
+    int count = 0;
+    auto next = [&count] ()
+    {
+        return ++count;
+    };
+    MEREMEMO_LOG(trace) << "compiled out " << next();
+    CONFIRM_THAT(count, MereTDD::Equals(0));
+
+    std::string message = "ranked ";
+    message += Util::randomString();
+    MEREMEMO_LOG(error, red) << message << " " << next();
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+
+    bool result = Util::isTextInFile(message, "logs/application.log",
+        {" color=\"red\" "});
+    CONFIRM_TRUE(result);
+}
+
+TEST("Every inverted tag is used to filter messages")
+{
+    MereTDD::SetupAndTeardown<TempFilterClause> filter;
+    MereMemo::addFilterLiteral(filter.id(), red, false);
+    MereMemo::addFilterLiteral(filter.id(), large, false);
+
+    std::string message = "all inverted ";
+    message += Util::randomString();
+    MereMemo::log(large) << message;
+
+    bool result = Util::isTextInFile(message, "logs/application.log");
+    CONFIRM_FALSE(result);
+
+    MereMemo::log(small) << message;
+
+    result = Util::isTextInFile(message, "logs/application.log");
+    CONFIRM_TRUE(result);
+}
+
+TEST("String tag values can be compared to filter messages")
+{
+    MereTDD::SetupAndTeardown<TempFilterClause> filter;
+    MereMemo::addFilterLiteral(filter.id(),
+        Size("m", MereMemo::TagOperation::LessThan));
+
+    std::string message = "string compare ";
+    message += Util::randomString();
+    MereMemo::log(small) << message;
+
+    bool result = Util::isTextInFile(message, "logs/application.log");
+    CONFIRM_FALSE(result);
+
+    MereMemo::log(large) << message;
+
+    result = Util::isTextInFile(message, "logs/application.log");
+    CONFIRM_TRUE(result);
+}
+
+TEST("Sampling writes one in every N matching messages")
+{
+    Identity id(-18);
+    int limit = MereMemo::addSampling(id, 10);
+
+    int count = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        MereMemo::log(id) << "sampled " << FormatCounter {count};
+    }
+    MereMemo::log(Identity(-19)) << "not sampled " << FormatCounter {count};
+    CONFIRM_THAT(count, MereTDD::Equals(11));
+    CONFIRM_THAT(MereMemo::limitedLogCount(limit), MereTDD::Equals(90ull));
+    MereMemo::removeLogLimit(limit);
+}
+
+TEST("Token bucket gives a burst and then a token each interval")
+{
+    // Five tokens each second means a token every 200ms.
+    MereMemo::TokenBucket bucket(5, 5);
+    std::int64_t const second = 1'000'000'000;
+    std::int64_t const start = 10 * second;
+    std::int64_t const interval = second / 5;
+
+    int taken = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        taken += bucket.take(start) ? 1 : 0;
+    }
+    CONFIRM_THAT(taken, MereTDD::Equals(5));
+
+    // A token that is given back can be taken again.
+    bucket.giveBack();
+    CONFIRM_TRUE(bucket.take(start));
+    CONFIRM_FALSE(bucket.take(start + interval - 1));
+    CONFIRM_TRUE(bucket.take(start + interval));
+    CONFIRM_FALSE(bucket.take(start + interval));
+
+    // A long wait only fills the bucket up to the burst.
+    taken = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        taken += bucket.take(start + 10 * second) ? 1 : 0;
+    }
+    CONFIRM_THAT(taken, MereTDD::Equals(5));
+}
+
+TEST("Rate limit writes a burst and then leaves records out")
+{
+    // The rate is so low that no tokens come back during the test.
+    Identity id(-180);
+    int limit = MereMemo::addRateLimit(id, 0.001, 5);
+
+    int count = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        MereMemo::logf(id, "rate limited {}", FormatCounter {count});
+    }
+    CONFIRM_THAT(count, MereTDD::Equals(5));
+    CONFIRM_THAT(MereMemo::limitedLogCount(limit), MereTDD::Equals(15ull));
+    MereMemo::removeLogLimit(limit);
+}
+
+TEST("Limits after the first to leave a record out are not used")
+{
+    Identity id(-181);
+    int rateLimit = MereMemo::addRateLimit(id, 0.001, 1);
+    int sampling = MereMemo::addSampling(id, 2);
+
+    int count = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        MereMemo::log(id) << "limited twice " << FormatCounter {count};
+    }
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+    CONFIRM_THAT(MereMemo::limitedLogCount(rateLimit),
+        MereTDD::Equals(3ull));
+    CONFIRM_THAT(MereMemo::limitedLogCount(sampling),
+        MereTDD::Equals(0ull));
+    MereMemo::removeLogLimit(sampling);
+    MereMemo::removeLogLimit(rateLimit);
+}
+
+TEST("Limits give back their token when a later limit leaves a record out")
+{
+    // The sampling is checked first. Whenever it lets a record
+    // through that the rate limit then leaves out, the sampling
+    // slot goes to the next record instead.
+    Identity id(-184);
+    int sampling = MereMemo::addSampling(id, 2);
+    int rateLimit = MereMemo::addRateLimit(id, 0.001, 1);
+
+    int count = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        MereMemo::log(id) << "given back " << FormatCounter {count};
+    }
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+    CONFIRM_THAT(MereMemo::limitedLogCount(sampling),
+        MereTDD::Equals(1ull));
+    CONFIRM_THAT(MereMemo::limitedLogCount(rateLimit),
+        MereTDD::Equals(2ull));
+    MereMemo::removeLogLimit(rateLimit);
+    MereMemo::removeLogLimit(sampling);
+}
+
+TEST("Rate limited call site only uses tokens for written records")
+{
+    MereTDD::SetupAndTeardown<TempFilterClause> filter;
+    MereMemo::addFilterLiteral(filter.id(), Identity(-182));
+
+    // The call site gets a single token and the records
+    // that the filter leaves out must not take it.
+    int count = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        Identity id(i < 5 ? -183 : -182);
+        MEREMEMO_LOG_RATE(0.001, info, id) << "call site limited "
+            << FormatCounter {count};
+    }
+    CONFIRM_THAT(count, MereTDD::Equals(1));
+}
+
+TEST("Context tags are added to messages in scope")
+{
+    std::string message = "context ";
+    message += Util::randomString();
+    {
+        MereMemo::ScopedLogContext context(Count(7), Size("huge"));
+        MereMemo::log(error) << message << " inside";
+
+        // Tags given to the call replace context tags with the same key.
+        MereMemo::log(error, Count(8)) << message << " replaced";
+    }
+    MereMemo::log(error) << message << " outside";
+
+    bool result = Util::isTextInFile(message + " inside",
+        "logs/application.log", {" count=7 ", " size=\"huge\" "});
+    CONFIRM_TRUE(result);
+    result = Util::isTextInFile(message + " replaced",
+        "logs/application.log", {" count=8 "}, {" count=7 "});
+    CONFIRM_TRUE(result);
+    result = Util::isTextInFile(message + " outside",
+        "logs/application.log", {}, {" count=7 ", " size=\"huge\" "});
+    CONFIRM_TRUE(result);
+}
+
+TEST("Default tags are replaced by tags with the same key")
+{
+    std::string message = "replaced default ";
+    message += Util::randomString();
+    MereMemo::log(error, red) << message;
+    MereMemo::log(error) << message << " kept";
+
+    bool result = Util::isTextInFile(message, "logs/application.log",
+        {" log_level=\"error\" ", " color=\"red\" "},
+        {" log_level=\"info\" ", " color=\"green\" "});
+    CONFIRM_TRUE(result);
+    result = Util::isTextInFile(message + " kept", "logs/application.log",
+        {" log_level=\"error\" ", " color=\"green\" "},
+        {" log_level=\"info\" "});
+    CONFIRM_TRUE(result);
+}
+
+TEST("Tag data matches the same way as tags")
+{
+    Count five(5);
+    Count moreThanThree(3, MereMemo::TagOperation::GreaterThan);
+    Count moreThanSeven(7, MereMemo::TagOperation::GreaterThan);
+    CONFIRM_TRUE(five.data().matches(moreThanThree.data()));
+    CONFIRM_TRUE(moreThanThree.data().matches(five.data()));
+    CONFIRM_FALSE(five.data().matches(moreThanSeven.data()));
+    CONFIRM_FALSE(five.data().matches(Identity(5).data()));
+
+    Color original("purple");
+    Color copy(original);
+    CONFIRM_TRUE(copy.data().matches(original.data()));
+    CONFIRM_THAT(std::string(copy.data().text),
+        MereTDD::Equals("color=\"purple\""));
+    CONFIRM_FALSE(copy.data().text.data() == original.data().text.data());
+}
+
+TEST("Tags are written in key name order")
+{
+    std::string message = "tag order ";
+    message += Util::randomString();
+    MereMemo::log(Size("small"), error, Count(3)) << message;
+
+    bool result = Util::isTextInFile(message, "logs/application.log",
+        {" color=\"green\" count=3 log_level=\"error\" size=\"small\" "});
     CONFIRM_TRUE(result);
 }
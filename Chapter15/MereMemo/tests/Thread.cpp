@@ -1,8 +1,10 @@
 #include "../Log.h"
 
+#include "LogTags.h"
 #include "Util.h"
 
 #include <MereTDD/Test.h>
+#include <atomic>
 #include <thread>
 
 TEST("log can be called from multiple threads")
@@ -37,7 +39,245 @@ TEST("log can be called from multiple threads")
     }
     for (auto const & message: messages)
     {
-        bool result = Util::isTextInFile(message, "application.log");
+        bool result = Util::isTextInFile(message, "logs/application.log");
         CONFIRM_TRUE(result);
     }
 }
+
+TEST("log can be written from a background thread")
+{
+    MereMemo::enableAsyncLogging(16);
+
+    std::vector<std::string> messages;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < 3; ++c)
+    {
+        std::string message = std::to_string(c);
+        message += " async message ";
+        message += Util::randomString();
+        messages.push_back(message);
+    }
+    for (int c = 0; c < 3; ++c)
+    {
+        threads.emplace_back(
+            [c, &messages]()
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                MereMemo::log() << messages[c] << " " << i;
+            }
+        });
+    }
+
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+    MereMemo::disableAsyncLogging();
+
+    for (auto const & message: messages)
+    {
+        bool result = Util::isTextInFile(message + " 49",
+            "logs/application.log");
+        CONFIRM_TRUE(result);
+    }
+}
+
+TEST("Queued records go to the outputs in use when they were logged")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::atomic<bool> open {false};
+    std::size_t oldCount = 0;
+    MereMemo::addLogOutput(GateOutput(open, oldCount));
+    MereMemo::enableAsyncLogging(16);
+
+    // The writer waits in the first record until the gate opens
+    // so the rest are still queued when the outputs change.
+    for (int i = 0; i < 10; ++i)
+    {
+        MereMemo::log() << "queued " << i;
+    }
+    std::size_t newCount = 0;
+    std::vector<std::shared_ptr<MereMemo::Output>> newOutputs;
+    newOutputs.push_back(CountingOutput(newCount).clone());
+    MereMemo::swapLogOutputs(newOutputs);
+    open = true;
+    MereMemo::disableAsyncLogging();
+
+    CONFIRM_THAT(oldCount, MereTDD::Equals(10u));
+    CONFIRM_THAT(newCount, MereTDD::Equals(0u));
+}
+
+TEST("Deferred messages are formatted by the background thread")
+{
+    MereMemo::enableAsyncLogging(16, MereMemo::QueueFullPolicy::Block, true);
+
+    std::string id = Util::randomString();
+    for (int i = 0; i < 50; ++i)
+    {
+        // The string is gone before the writer formats the message.
+        std::string name = "deferred " + id;
+        MereMemo::logf(error, "{} count={} ratio={} done={}",
+            name, i, 0.5, i == 49);
+    }
+    MereMemo::disableAsyncLogging();
+
+    bool result = Util::isTextInFile(
+        "deferred " + id + " count=49 ratio=0.5 done=true",
+        "logs/application.log", {"log_level=\"error\""});
+    CONFIRM_TRUE(result);
+}
+
+TEST("A full queue drops records with the Drop policy")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::atomic<bool> open {false};
+    std::size_t count = 0;
+    MereMemo::addLogOutput(GateOutput(open, count));
+    unsigned long long droppedBefore = MereMemo::droppedLogCount();
+    MereMemo::enableAsyncLogging(2, MereMemo::QueueFullPolicy::Drop);
+
+    // Once the writer waits in the gate with the first record,
+    // two more fit in the queue and the rest are dropped.
+    MereMemo::log() << "drop first";
+    Util::waitForEmptyLogQueue();
+    for (int i = 0; i < 10; ++i)
+    {
+        MereMemo::log() << "drop " << i;
+    }
+    unsigned long long dropped =
+        MereMemo::droppedLogCount() - droppedBefore;
+    open = true;
+    MereMemo::disableAsyncLogging();
+
+    CONFIRM_THAT(dropped, MereTDD::Equals(8ull));
+    CONFIRM_THAT(count, MereTDD::Equals(3u));
+}
+
+TEST("A full queue writes on the caller's thread with the Synchronous policy")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::vector<std::string> lines;
+    std::atomic<std::size_t> lineCount {0};
+    std::atomic<bool> open {false};
+    std::size_t gateCount = 0;
+    MereMemo::addLogOutput(LinesOutput(lines, lineCount));
+    MereMemo::addLogOutput(GateOutput(open, gateCount));
+    MereMemo::enableAsyncLogging(1, MereMemo::QueueFullPolicy::Synchronous);
+
+    // The writer sends the first record to the lines and then waits
+    // in the gate. The second record fills the queue so the third
+    // gets written by the thread that logs it. That thread reaches
+    // the lines before the second record does and then also waits.
+    MereMemo::log() << "synchronous 1";
+    Util::waitForEmptyLogQueue();
+    MereMemo::log() << "synchronous 2";
+    std::thread caller([] ()
+    {
+        MereMemo::log() << "synchronous 3";
+    });
+    while (lineCount < 2)
+    {
+        std::this_thread::yield();
+    }
+    open = true;
+    caller.join();
+    MereMemo::disableAsyncLogging();
+
+    CONFIRM_THAT(lines.size(), MereTDD::Equals(3u));
+    CONFIRM_TRUE(lines[0].ends_with("synchronous 1"));
+    CONFIRM_TRUE(lines[1].ends_with("synchronous 3"));
+    CONFIRM_TRUE(lines[2].ends_with("synchronous 2"));
+    CONFIRM_THAT(gateCount, MereTDD::Equals(3u));
+}
+
+TEST("Every output gets the records logged from many threads")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::size_t firstCount = 0;
+    std::size_t secondCount = 0;
+    MereMemo::addLogOutput(CountingOutput(firstCount));
+    MereMemo::addLogOutput(CountingOutput(secondCount));
+
+    // The time this takes is measured by the threads
+    // cases in the benchmarks instead.
+    constexpr int threadCount = 8;
+    constexpr int recordsPerThread = 2000;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < threadCount; ++c)
+    {
+        threads.emplace_back([] ()
+        {
+            for (int i = 0; i < recordsPerThread; ++i)
+            {
+                MereMemo::log() << "many threads " << i;
+            }
+        });
+    }
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+
+    std::size_t expectedCount = threadCount * recordsPerThread;
+    CONFIRM_THAT(firstCount, MereTDD::Equals(expectedCount));
+    CONFIRM_THAT(secondCount, MereTDD::Equals(expectedCount));
+}
+
+TEST("Filters can change while threads are logging")
+{
+    MereTDD::SetupAndTeardown<TempOutputs> outputs;
+    std::size_t count = 0;
+    MereMemo::addLogOutput(CountingOutput(count));
+
+    std::atomic<bool> done {false};
+    std::vector<std::thread> threads;
+    for (int c = 0; c < 3; ++c)
+    {
+        threads.emplace_back([&done] ()
+        {
+            while (not done)
+            {
+                MereMemo::log() << "changing filters";
+            }
+        });
+    }
+
+    for (int i = 0; i < 100; ++i)
+    {
+        int id = MereMemo::createFilterClause();
+        MereMemo::addFilterLiteral(id, Count(1));
+        MereMemo::clearFilterClause(id);
+    }
+    done = true;
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+
+    std::size_t before = count;
+    MereMemo::log() << "after filters changed";
+    CONFIRM_THAT(count, MereTDD::Equals(before + 1));
+}
+
+TEST("Context tags can be copied to another thread")
+{
+    std::string message = "copied context ";
+    message += Util::randomString();
+
+    std::thread worker;
+    {
+        MereMemo::ScopedLogContext context(Count(21));
+        worker = std::thread([&message,
+            contextCopy = MereMemo::LogContextCopy()] ()
+        {
+            MereMemo::ScopedLogContext context(contextCopy);
+            MereMemo::log(error) << message;
+        });
+    }
+    worker.join();
+
+    bool result = Util::isTextInFile(message, "logs/application.log",
+        {" count=21 "});
+    CONFIRM_TRUE(result);
+}
@@ -1,8 +1,10 @@
 #include "Util.h"
 
+#include "../Log.h"
+
 #include <chrono>
-#include <fstream>
 #include <random>
+#include <thread>
 
 std::string Util::randomString ()
 {
@@ -29,28 +31,39 @@ bool Util::isTextInFile (
     std::vector<std::string> const & wantedTags,
     std::vector<std::string> const & unwantedTags)
 {
-    std::ifstream logfile(fileName.data());
-    std::string line;
-    while (getline(logfile, line))
+    // Buffered log lines need to reach the file before it is read.
+    MereMemo::flushOutputs();
+
+    MereMemo::MappedLogFile logfile {std::string(fileName)};
+    MereMemo::LogQuery query;
+    query.text.emplace_back(text);
+    query.maxLines = 1;
+    auto lines = MereMemo::queryLog(logfile.contents(), query);
+    if (lines.empty())
+    {
+        return false;
+    }
+    for (auto const & tag: wantedTags)
     {
-        if (line.find(text) != std::string::npos)
+        if (lines.front().find(tag) == std::string_view::npos)
         {
-            for (auto const & tag: wantedTags)
-            {
-                if (line.find(tag) == std::string::npos)
-                {
-                    return false;
-                }
-            }
-            for (auto const & tag: unwantedTags)
-            {
-                if (line.find(tag) != std::string::npos)
-                {
-                    return false;
-                }
-            }
-            return true;
+            return false;
         }
     }
-    return false;
+    for (auto const & tag: unwantedTags)
+    {
+        if (lines.front().find(tag) != std::string_view::npos)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Util::waitForEmptyLogQueue ()
+{
+    while (MereMemo::stats().queueDepth > 0)
+    {
+        std::this_thread::yield();
+    }
 }
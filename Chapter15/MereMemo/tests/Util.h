@@ -1,8 +1,13 @@
 #ifndef MEREMEMO_TESTS_UTIL_H
 #define MEREMEMO_TESTS_UTIL_H
 
+#include "../Log.h"
+
+#include <atomic>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 struct Util
@@ -14,6 +19,118 @@ struct Util
         std::string_view fileName,
         std::vector<std::string> const & wantedTags = {},
         std::vector<std::string> const & unwantedTags = {});
+
+    // Returns once the async writer has taken every queued record.
+    static void waitForEmptyLogQueue ();
+};
+
+// Lets a test log to its own outputs and then puts
+// back the outputs that were set in main.
+class TempOutputs
+{
+public:
+    void setup ()
+    {
+        MereMemo::swapLogOutputs(mSavedOutputs);
+    }
+
+    void teardown ()
+    {
+        MereMemo::swapLogOutputs(mSavedOutputs);
+    }
+
+private:
+    std::vector<std::shared_ptr<MereMemo::Output>> mSavedOutputs;
+};
+
+// Counts the lines it gets without keeping them.
+class CountingOutput : public MereMemo::Output
+{
+public:
+    CountingOutput (std::size_t & count)
+    : mCount(count)
+    { }
+
+    CountingOutput (CountingOutput const & rhs)
+    : mCount(rhs.mCount)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new CountingOutput(*this));
+    }
+
+    void sendLine (std::string_view) override
+    {
+        ++mCount;
+    }
+
+private:
+    std::size_t & mCount;
+};
+
+// Holds up whichever thread sends it a line until the test opens
+// the gate. This keeps the async writer busy so its queue fills.
+class GateOutput : public CountingOutput
+{
+public:
+    GateOutput (std::atomic<bool> & open, std::size_t & count)
+    : CountingOutput(count), mOpen(open)
+    { }
+
+    GateOutput (GateOutput const & rhs)
+    : CountingOutput(rhs), mOpen(rhs.mOpen)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new GateOutput(*this));
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        while (not mOpen)
+        {
+            std::this_thread::yield();
+        }
+        CountingOutput::sendLine(line);
+    }
+
+private:
+    std::atomic<bool> & mOpen;
+};
+
+// Keeps the lines in the order they arrive. The count can be
+// watched by another thread while the lines are being sent.
+class LinesOutput : public MereMemo::Output
+{
+public:
+    LinesOutput (std::vector<std::string> & lines,
+        std::atomic<std::size_t> & count)
+    : mLines(lines), mCount(count)
+    { }
+
+    LinesOutput (LinesOutput const & rhs)
+    : mLines(rhs.mLines), mCount(rhs.mCount)
+    { }
+
+    std::unique_ptr<Output> clone () const override
+    {
+        return std::unique_ptr<Output>(
+            new LinesOutput(*this));
+    }
+
+    void sendLine (std::string_view line) override
+    {
+        mLines.emplace_back(line);
+        ++mCount;
+    }
+
+private:
+    std::vector<std::string> & mLines;
+    std::atomic<std::size_t> & mCount;
 };
 
 #endif // MEREMEMO_TESTS_UTIL_H
@@ -9,9 +9,9 @@
 int main ()
 {
     MereMemo::FileOutput appFile("logs");
-    //appFile.namePattern() = "application-{}.log";
-    //appFile.maxSize() = 10'000'000;
-    //appFile.rolloverCount() = 5;
+    appFile.namePattern() = "application{}.log";
+    appFile.maxSize() = 10'000'000;
+    appFile.rolloverCount() = 5;
     MereMemo::addLogOutput(appFile);
 
     MereMemo::StreamOutput consoleStream(std::cout);
@@ -20,5 +20,7 @@ int main ()
     MereMemo::addDefaultTag(info);
     MereMemo::addDefaultTag(green);
 
+    MereMemo::addFlushTag(error);
+
     return MereTDD::runTests(std::cout);
 }
@@ -0,0 +1,32 @@
+#include "../Log.h"
+
+#include <fstream>
+#include <iostream>
+
+// Prints the text form of one or more binary log files.
+int main (int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " file.mlog..." << std::endl;
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::ifstream input(argv[i], std::ios::binary);
+        if (not input)
+        {
+            std::cerr << "Unable to open " << argv[i] << std::endl;
+            result = 1;
+            continue;
+        }
+        if (not MereMemo::decodeBinaryLog(input, std::cout))
+        {
+            std::cerr << "Invalid binary log " << argv[i] << std::endl;
+            result = 1;
+        }
+    }
+    return result;
+}
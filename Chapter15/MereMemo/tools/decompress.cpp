@@ -0,0 +1,32 @@
+#include "../Log.h"
+
+#include <fstream>
+#include <iostream>
+
+// Prints the lines of a compressed log file. The lines can be
+// limited to a time window such as:
+// decompress application.mlz 2022-06-25T20:00 2022-06-25T20:15
+int main (int argc, char * argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " file.mlz [from [to]]"
+            << std::endl;
+        return 2;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    if (not input)
+    {
+        std::cerr << "Unable to open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string_view from = argc > 2 ? argv[2] : "";
+    std::string_view to = argc > 3 ? argv[3] : "";
+    if (not MereMemo::decompressLog(input, std::cout, from, to))
+    {
+        std::cerr << "Invalid compressed log " << argv[1] << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "../Log.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Prints the lines of text log files that match a query such as:
+// query --from 2022-06-25T20:00 --to 2022-06-25T20:15
+//     --tag log_level=error --tag count>=5 --text timeout application.log
+// Every option can be left out and --text and --tag can be repeated.
+int main (int argc, char * argv[])
+{
+    MereMemo::LogQuery query;
+    std::vector<std::string> files;
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string_view arg = argv[i];
+            if (not arg.starts_with("--"))
+            {
+                files.emplace_back(arg);
+                continue;
+            }
+            if (i + 1 == argc)
+            {
+                throw std::invalid_argument("Missing value for option.");
+            }
+            std::string_view value = argv[++i];
+            if (arg == "--from")
+            {
+                query.from = value;
+            }
+            else if (arg == "--to")
+            {
+                query.to = value;
+            }
+            else if (arg == "--text")
+            {
+                query.text.emplace_back(value);
+            }
+            else if (arg == "--tag")
+            {
+                query.tags.push_back(MereMemo::parseLogTagPredicate(value));
+            }
+            else if (arg == "--limit")
+            {
+                query.maxLines = std::stoul(std::string(value));
+            }
+            else if (arg == "--threads")
+            {
+                query.threads = std::stoul(std::string(value));
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown option.");
+            }
+        }
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << e.what() << std::endl;
+        files.clear();
+    }
+    if (files.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " [--from time] [--to time] "
+            "[--text text]... [--tag key=value]... [--limit lines] "
+            "[--threads count] file..." << std::endl;
+        return 2;
+    }
+
+    for (auto const & file: files)
+    {
+        MereMemo::MappedLogFile log(file);
+        if (not log.isOpen())
+        {
+            std::cerr << "Unable to open " << file << std::endl;
+            return 1;
+        }
+        for (auto const & line: MereMemo::queryLog(log.contents(), query))
+        {
+            std::cout << line << '\n';
+        }
+    }
+    return 0;
+}
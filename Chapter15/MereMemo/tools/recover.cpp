@@ -0,0 +1,54 @@
+#include "../Log.h"
+
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// Prints the newest lines left in a mapped ring file, such as one
+// left behind by a process that crashed.
+int main (int argc, char * argv[])
+{
+    constexpr std::size_t megabyte = 1024 * 1024;
+    std::size_t maxBytes = std::numeric_limits<std::size_t>::max();
+    try
+    {
+        if (argc < 2 || argc > 3)
+        {
+            throw std::invalid_argument("Wrong number of arguments.");
+        }
+        if (argc == 3)
+        {
+            std::string megabytes = argv[2];
+            std::size_t used = 0;
+            unsigned long long value = std::stoull(megabytes, &used);
+            if (used != megabytes.size() || megabytes.front() == '-' ||
+                value > maxBytes / megabyte)
+            {
+                throw std::out_of_range("Invalid megabytes.");
+            }
+            maxBytes = value * megabyte;
+        }
+    }
+    catch (std::logic_error const &)
+    {
+        std::cerr << "Usage: " << argv[0] << " file.ring [megabytes]"
+            << std::endl;
+        return 2;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    if (not input)
+    {
+        std::cerr << "Unable to open " << argv[1] << std::endl;
+        return 1;
+    }
+    if (not MereMemo::recoverMappedRing(input, std::cout, maxBytes))
+    {
+        std::cerr << "Invalid mapped ring " << argv[1] << std::endl;
+        return 1;
+    }
+    return 0;
+}
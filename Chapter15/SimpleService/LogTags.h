@@ -6,9 +6,9 @@
 namespace SimpleService
 {
 
-inline MereMemo::LogLevel error("error");
-inline MereMemo::LogLevel info("info");
-inline MereMemo::LogLevel debug("debug");
+inline MereMemo::RankedLogLevel<30> error("error");
+inline MereMemo::RankedLogLevel<20> info("info");
+inline MereMemo::RankedLogLevel<10> debug("debug");
 
 class User : public MereMemo::StringTagType<User>
 {
@@ -95,7 +95,7 @@ void SimpleService::testCalc (
 
 void SimpleService::Service::start ()
 {
-    MereMemo::log(info) << "Service is starting.";
+    MEREMEMO_LOG(info) << "Service is starting.";
 }
 
 SimpleService::ResponseVar SimpleService::Service::handleRequest (
@@ -103,12 +103,15 @@ SimpleService::ResponseVar SimpleService::Service::handleRequest (
     std::string const & path,
     RequestVar const & request)
 {
+    // Everything logged while handling the request is tagged
+    // with the user and path.
+    MereMemo::ScopedLogContext logContext {User(user), LogPath(path)};
+
     ResponseVar response;
     if (auto const * req = std::get_if<CalculateRequest>(&request))
     {
-        MereMemo::log(debug, User(user), LogPath(path))
-            << "Received Calculate request for: "
-            << std::to_string(req->mSeed);
+        MEREMEMO_LOGF(debug,
+            "Received Calculate request for: {}", req->mSeed);
 
         calculations.emplace_back();
         int calcIndex = calculations.size() - 1;
@@ -138,7 +141,9 @@ SimpleService::ResponseVar SimpleService::Service::handleRequest (
     }
     else if (auto const * req = std::get_if<StatusRequest>(&request))
     {
-        MereMemo::log(debug, User(user), LogPath(path))
+        // Clients poll for status so these are limited to keep
+        // them from flooding the log.
+        MEREMEMO_LOG_RATE(100, debug)
             << "Received Status request for: "
             << req->mToken;
 
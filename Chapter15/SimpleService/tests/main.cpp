@@ -8,5 +8,14 @@ int main ()
     MereMemo::FileOutput appFile("logs");
     MereMemo::addLogOutput(appFile);
 
+#if not defined(_WIN32)
+    // The ring gets the same messages as the file. Since it lives in
+    // mapped memory, the newest ones can be recovered after a crash
+    // even when the file buffer never got written.
+    MereMemo::MappedRingOutput ring("logs");
+    ring.fileName() = "service.ring";
+    MereMemo::addLogOutput(ring);
+#endif
+
     return MereTDD::runTests(std::cout);
 }